@@ -255,6 +255,28 @@ Glossary of Terms:
 ## Headers and configurations macros 
 **/
 
+/**
+On Unix systems the core can be allocated with **mmap** instead of **calloc**,
+which gives us control over how it is paged in, and commands can be run with
+**posix_spawnp** with their output captured. These need to be requested
+before any system headers are included, as does the monotonic clock and
+sleep timers use. Define **NO_MMAP**, **NO_SPAWN** or **NO_MONOTONIC** to
+turn them off.
+**/
+#if defined(__unix__) && !defined(NO_MMAP)
+#define USE_MMAP
+#endif
+#if defined(__unix__) && !defined(NO_SPAWN)
+#define USE_SPAWN
+#endif
+#if defined(__unix__) && !defined(NO_MONOTONIC)
+#define USE_MONOTONIC
+#endif
+#if (defined(USE_MMAP) || defined(USE_SPAWN) || defined(USE_MONOTONIC)) && \
+	!defined(_DEFAULT_SOURCE)
+#define _DEFAULT_SOURCE
+#endif
+
 /** 
 This file implements a Forth library, so a Forth interpreter can be embedded
 in another application, as such a subset of the functions in this file are
@@ -280,6 +302,16 @@ more memory.
 #include <string.h>
 #include <setjmp.h>
 #include <time.h>
+#ifdef USE_MMAP
+#include <sys/mman.h>
+#endif
+#ifdef USE_SPAWN
+#include <fcntl.h>
+#include <poll.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
 
 /**
 Traditionally Forth implementations were the only program running on the
@@ -314,10 +346,14 @@ character pointers instead of cell pointers, like **ck** does.
 			o->core_size * sizeof(forth_cell_t))
 /**
 @brief This is a wrapper around **check_depth**, to make checking the depth 
-short and simple.
+short and simple. As it is only used within **forth_run** the cached
+virtual machine registers are written back before an error is thrown, and
+the depth takes into account the stack cache, if it is in use.
 @param DEPTH current depth of the stack
 **/
-#define cd(DEPTH) check_depth(o, &on_error, S, (DEPTH), __LINE__)
+#define cd(DEPTH) do {\
+		if (check_depth(o, S + cache_depth(), (DEPTH), __LINE__)) {\
+		sync_registers(); longjmp(on_error, RECOVERABLE); } } while (0)
 /**
 @brief This macro makes sure any dictionary pointers never cross into 
 the stack area.
@@ -342,7 +378,7 @@ the debug code.
 
 #define ck(C) (C)
 #define ckchar(C) (C)
-#define cd(DEPTH) ((void)DEPTH)
+#define cd(DEPTH) ((void)(DEPTH))
 #define dic(DPTR) check_dictionary(o, &on_error, (DPTR))
 #define TRACE(ENV, INSTRUCTION, STK, TOP)
 #endif
@@ -717,6 +753,18 @@ the size must be a power of two, so its binary logarithm can be stored
 in a single byte.
 
 **/
+/**
+@brief A **forth_location** records which input source, and which line
+within it, the code compiled into the dictionary from **address** onward
+came from, up to the address in the next location recorded. A table of
+these is kept outside of the Forth core, if enabled.
+**/
+struct forth_location {
+	forth_cell_t address; /**< first cell compiled from this line */
+	forth_cell_t source;  /**< input source identifier */
+	forth_cell_t line;    /**< line number within that source */
+};
+
 struct forth { /**< FORTH environment */
 	uint8_t header[sizeof(header)]; /**< ~~ header for core file */
 	forth_cell_t core_size;  /**< size of VM */
@@ -728,6 +776,19 @@ struct forth { /**< FORTH environment */
 	int unget;           /**< single character of push back */
 	bool unget_set;      /**< character is in the push back buffer? */
 	size_t line;         /**< count of new lines read in */
+	forth_cell_t *profile; /**< execution counts indexed by CODE field */
+	forth_cell_t source; /**< identifies the current input source */
+	forth_cell_t sources;/**< number of input sources set so far */
+	struct forth_location *locations; /**< source locations of code */
+	size_t location_count; /**< number of source locations recorded */
+	size_t location_max;   /**< number of locations allocated */
+	FILE *record;        /**< non-deterministic input is logged here */
+	FILE *replay;        /**< non-deterministic input is read from here */
+	struct replayed_string *strings; /**< strings created in replay */
+	struct heap_profile *heap; /**< ALLOCATE/FREE profile, if enabled */
+	size_t mapped;       /**< size of mapping, if core was mmap'ed */
+	struct screen *screen; /**< off screen buffer, if one was made */
+	struct timers *timers; /**< scheduled callbacks, if any */
 	forth_cell_t m[];    /**< ~~ Forth Virtual Machine memory */
 };
 
@@ -940,6 +1001,29 @@ up for debugging purposes (like **pnum**).
  X(2, RESIZE,    "resize",         " r-addr u -- r-addr ior : resize a block of memory")\
  X(2, GETENV,    "getenv",         " c-addr u -- r-addr u : return an environment variable")\
  X(1, BYE,       "(bye)",          " u -- : bye, bye!")\
+ X(0, FOOTPRINT, "footprint",      " -- : print out how the core is being used")\
+ X(5, SPAWNCAPTURE, "(spawn-capture)", "c-addr u buf u ms -- u status : run command, capture output")\
+ X(2, SPAWN,     "spawn",          "c-addr u -- file-id pid ior : run command, read its output")\
+ X(2, SPAWNWAIT, "spawn-wait",     "file-id pid -- status : close output, wait for command")\
+ X(4, COMPRESS,  "compress",       "c-addr1 u1 c-addr2 u2 -- u : compress c-addr1 into c-addr2")\
+ X(4, DECOMPRESS, "decompress",    "c-addr1 u1 c-addr2 u2 -- u : decompress c-addr1 into c-addr2")\
+ X(2, FCOMPRESS, "compress-file",  "file-id1 file-id2 -- ior : compress file-id1 into file-id2")\
+ X(2, FDECOMPRESS, "decompress-file", "file-id1 file-id2 -- ior : decompress file-id1 into file-id2")\
+ X(4, TOHEX,     ">hex",           "c-addr1 u1 c-addr2 u2 -- u : encode c-addr1 as hex into c-addr2")\
+ X(4, FROMHEX,   "hex>",           "c-addr1 u1 c-addr2 u2 -- u : decode hex c-addr1 into c-addr2")\
+ X(4, TOBASE64,  ">base64",        "c-addr1 u1 c-addr2 u2 -- u : encode c-addr1 as base64 into c-addr2")\
+ X(4, FROMBASE64, "base64>",       "c-addr1 u1 c-addr2 u2 -- u : decode base64 c-addr1 into c-addr2")\
+ X(4, DUMP,      "(dump)",         "addr u base bool -- : print u cells, as characters if bool is true")\
+ X(5, SPLIT,     "split-fields",   "c-addr u char addr u -- n : split c-addr into fields delimited by char")\
+ X(3, FRECORD,   "read-record",    "c-addr u file-id -- u bool ior : read a record of delimited text")\
+ X(2, FORMAT,    "format",         "x... c-addr u -- : print arguments as described by c-addr")\
+ X(4, FORMATBUF, "format>buf",     "x... c-addr1 u1 c-addr2 u2 -- u : format arguments into c-addr2")\
+ X(2, SCREENSIZE, "screen-size",   "cols rows -- ior : make an off screen buffer")\
+ X(0, SCREENCLEAR, "screen-clear", " -- : clear the off screen buffer")\
+ X(4, SCREENPUT, "screen-put",     "c-addr u col row -- : draw a string in the off screen buffer")\
+ X(2, SCREENREFRESH, "screen-refresh", "col row -- ior : draw what has changed, leaving the cursor at col row")\
+ X(1, BIG,       "(big)",          "x... u -- x... : perform bignum operation u")\
+ X(1, TIMER,     "(timer)",        "x... u -- x... : perform timer operation u")\
  X(0, LAST_INSTRUCTION, NULL, "")
 
 /** // @todo Implement these instructions? 
@@ -1063,6 +1147,127 @@ int forth_logger(const char *prefix, const char *func,
 	return r;
 }
 
+/**
+### Recording and Replaying Input
+
+Everything that the interpreter consumes that is not determined by the
+program itself, characters read from a file, the time, the environment,
+data read from files and the results of calls to C functions, can be
+recorded to a log. The log can then be replayed, instead of performing the
+operation the recorded result is used, so that a run can be reproduced
+exactly without the original input.
+
+The log is a sequence of events, each event is a single character tag
+followed by its data. Numbers are stored as a variable length encoding, with
+seven bits per byte and the top bit set on all but the last byte, and blocks
+of data are stored as a length followed by the bytes themselves.
+
+@note The results of opening and closing files are not recorded, only the
+data read from them, so the files opened need to exist when replaying.
+**/
+enum replay_events {
+	EVENT_CHAR   = 'c', /**< character read from a file by KEY or READ */
+	EVENT_CLOCK  = 't', /**< result of CLOCK */
+	EVENT_DATE   = 'd', /**< time used by DATE */
+	EVENT_GETENV = 'g', /**< result of GETENV */
+	EVENT_READ   = 'r', /**< result of, and data read by, FREAD */
+	EVENT_CALL   = 'x', /**< return value and stack effect of a CALL */
+};
+
+/**
+Strings returned by **getenv** during a replay need to be stored somewhere
+and must remain valid, they are kept in a list until **forth_free**.
+**/
+struct replayed_string {
+	struct replayed_string *next; /**< next string in list */
+	char s[];                     /**< NUL terminated string */
+};
+
+static void put_cell(FILE *out, forth_cell_t c)
+{
+	for (; c > 0x7f; c >>= 7)
+		fputc((c & 0x7f) | 0x80, out);
+	fputc(c, out);
+}
+
+static int get_cell(FILE *in, forth_cell_t *c)
+{
+	int ch;
+	unsigned shift = 0;
+	*c = 0;
+	do {
+		if ((ch = fgetc(in)) == EOF || shift >= sizeof(*c) * CHAR_BIT)
+			return -1;
+		*c |= (forth_cell_t)(ch & 0x7f) << shift;
+		shift += 7;
+	} while (ch & 0x80);
+	return 0;
+}
+
+static void record_event(forth_t *o, int event, forth_cell_t c)
+{
+	fputc(event, o->record);
+	put_cell(o->record, c);
+}
+
+static int replay_event(forth_t *o, int event, forth_cell_t *c)
+{
+	int e = fgetc(o->replay);
+	if (e != event) {
+		fatal("replay diverged, expected '%c' got %d", event, e);
+		return -1;
+	}
+	if (get_cell(o->replay, c) < 0) {
+		fatal("replay log truncated at event '%c'", event);
+		return -1;
+	}
+	return 0;
+}
+
+static int replay_block(forth_t *o, void *block, forth_cell_t length)
+{
+	if (fread(block, 1, length, o->replay) != length) {
+		fatal("replay log truncated reading %"PRIdCell" bytes", length);
+		return -1;
+	}
+	return 0;
+}
+
+static char *replay_string(forth_t *o, forth_cell_t length)
+{
+	struct replayed_string *r;
+	errno = 0;
+	if (!(r = calloc(sizeof(*r) + length + 1, 1))) {
+		fatal("replay allocation failed, %s", forth_strerror());
+		return NULL;
+	}
+	if (replay_block(o, r->s, length) < 0) {
+		free(r);
+		return NULL;
+	}
+	r->next = o->strings;
+	o->strings = r;
+	return r->s;
+}
+
+int forth_set_record(forth_t *o, FILE *log)
+{
+	assert(o);
+	if (log && o->replay)
+		return -1;
+	o->record = log;
+	return 0;
+}
+
+int forth_set_replay(forth_t *o, FILE *log)
+{
+	assert(o);
+	if (log && o->record)
+		return -1;
+	o->replay = log;
+	return 0;
+}
+
 /**
 @brief  Get a char from string input or a file
 @param  o   forth image containing information about current input stream
@@ -1103,7 +1308,18 @@ static int forth_get_char(forth_t *o)
 	}
 	switch (o->m[SOURCE_ID]) {
 	case FILE_IN:   
+		if (o->replay) {
+			forth_cell_t c;
+			if (replay_event(o, EVENT_CHAR, &c) < 0) {
+				forth_invalidate(o);
+				return EOF;
+			}
+			r = (int)c - 1;
+			break;
+		}
 		r = fgetc((FILE*)(o->m[FIN])); 
+		if (o->record)
+			record_event(o, EVENT_CHAR, r + 1);
 		break;
 	case STRING_IN: 
 		r = o->m[SIDX] >= o->m[SLEN] ? 
@@ -1409,20 +1625,22 @@ static forth_cell_t check_bounds(forth_t *o, jmp_buf *on_error,
 
 /**
 **check_depth** is used to check that there are enough values on the stack
-before an operation takes place. It is wrapped up in the **cd** macro. 
+before an operation takes place. It is wrapped up in the **cd** macro,
+which throws the error if this returns non-zero.
 **/
-static void check_depth(forth_t *o, jmp_buf *on_error, 
-		forth_cell_t *S, forth_cell_t expected, unsigned line)
+static int check_depth(forth_t *o, forth_cell_t *S, forth_cell_t expected, 
+		unsigned line)
 {
 	if (o->m[DEBUG] >= FORTH_DEBUG_CHECKS)
 		debug("0x%"PRIxCell " %u", (forth_cell_t)(S - o->vstart), line);
 	if ((uintptr_t)(S - o->vstart) < expected) {
 		error("stack underflow %p -> %u (line %zu)", S - o->vstart, line, o->line);
-		longjmp(*on_error, RECOVERABLE);
+		return -1;
 	} else if (S > o->vend) {
 		error("stack overflow %p -> %u (line %zu)", S - o->vend, line, o->line);
-		longjmp(*on_error, RECOVERABLE);
+		return -1;
 	}
+	return 0;
 }
 
 /**
@@ -1516,14 +1734,438 @@ static void trace(forth_t *o, forth_cell_t instruction,
 	fputs(" )\n", stderr);
 }
 
+/**
+## Screen Buffer
+
+Redrawing a whole terminal screen after every change is slow over a slow
+link, so instead text can be drawn into an off screen buffer with
+**screen-put** and **screen-refresh** works out what has changed since the
+last time it was called and sends only that, moving the cursor with ANSI
+escape codes and collecting everything into a single write. There are
+two copies of the screen; **back** is drawn into and **front** holds what
+the terminal is thought to show. Unchanged runs of characters shorter than
+**SCREEN_GAP** are sent again, as that is cheaper than moving the cursor
+over them.
+
+After drawing, the cursor is moved to a given position and everything from
+there to the end of the terminal is erased, which gets rid of any input
+that was echoed back or anything else printed since the last refresh, so
+it makes sense to leave the cursor where input is to be read. The buffer
+is drawn from scratch after it has been created with **screen-size**,
+which should be called again if something else clears the terminal.
+
+The screen is not part of the core and is not saved with it.
+**/
+#define SCREEN_GAP     (8u)
+#define SCREEN_MAX     (4096u)
+#define SCREEN_CURSOR  (32u) /* maximum length of a cursor movement */
+
+struct screen {
+	size_t cols, rows;
+	bool painted; /**< false if the terminal needs clearing and redrawing */
+	char *front, *back, *out;
+};
+
+static void screen_free(struct screen *s)
+{
+	if (!s)
+		return;
+	free(s->front);
+	free(s->back);
+	free(s->out);
+	free(s);
+}
+
+static int screen_size(forth_t *o, forth_cell_t cols, forth_cell_t rows)
+{
+	struct screen *s = NULL;
+	screen_free(o->screen);
+	o->screen = NULL;
+	if (!cols || !rows)
+		return 0;
+	if (cols > SCREEN_MAX || rows > SCREEN_MAX)
+		return -1;
+	if (!(s = calloc(1, sizeof(*s))))
+		return -1;
+	s->cols = cols;
+	s->rows = rows;
+	s->front = malloc(cols * rows);
+	s->back  = malloc(cols * rows);
+	s->out   = malloc(rows * (cols + (cols / SCREEN_GAP + 1) * SCREEN_CURSOR)
+			+ 4 * SCREEN_CURSOR);
+	if (!s->front || !s->back || !s->out) {
+		screen_free(s);
+		return -1;
+	}
+	memset(s->back, ' ', cols * rows);
+	o->screen = s;
+	return 0;
+}
+
+static void screen_put(struct screen *s, const char *str, size_t length, 
+		forth_cell_t col, forth_cell_t row)
+{
+	if (!s || row >= s->rows || col >= s->cols)
+		return;
+	char *d = s->back + row * s->cols + col;
+	if (length > s->cols - col)
+		length = s->cols - col;
+	for (size_t i = 0; i < length; i++)
+		d[i] = iscntrl((unsigned char)str[i]) ? ' ' : str[i];
+}
+
+static int screen_refresh(struct screen *s, FILE *out, 
+		forth_cell_t col, forth_cell_t row)
+{
+	char *d;
+	size_t r, c, at_row = SIZE_MAX, at_col = 0;
+	if (!s)
+		return -1;
+	d = s->out;
+	if (row >= s->rows || col >= s->cols)
+		row = s->rows - 1, col = s->cols - 1;
+	if (!s->painted) {
+		d += sprintf(d, "\x1b[2J");
+		memset(s->front, ' ', s->cols * s->rows);
+		s->painted = true;
+	}
+	d += sprintf(d, "\x1b[%u;%uH\x1b[J", (unsigned)row + 1, (unsigned)col + 1);
+	memset(s->front + row * s->cols + col, ' ', 
+			(s->rows - row) * s->cols - col);
+	for (r = 0; r < s->rows; r++) {
+		const char *b = s->back + r * s->cols, *f = s->front + r * s->cols;
+		for (c = 0; c < s->cols; ) {
+			size_t last = c + 1;
+			if (b[c] == f[c]) {
+				c++;
+				continue;
+			}
+			for (size_t i = last; i < s->cols && i - last < SCREEN_GAP; i++)
+				if (b[i] != f[i])
+					last = i + 1;
+			if (at_row != r || at_col != c)
+				d += sprintf(d, "\x1b[%u;%uH", (unsigned)r + 1, 
+						(unsigned)c + 1);
+			memcpy(d, b + c, last - c);
+			d += last - c;
+			at_row = r;
+			at_col = c = last;
+		}
+	}
+	if (at_row != SIZE_MAX && (at_row != row || at_col != col))
+		d += sprintf(d, "\x1b[%u;%uH", (unsigned)row + 1, (unsigned)col + 1);
+	memcpy(s->front, s->back, s->cols * s->rows);
+	fwrite(s->out, 1, d - s->out, out);
+	return fflush(out) || ferror(out) ? -1 : 0;
+}
+
+/**
+## Timers
+
+Words can be run after a delay, or periodically, with **after** and
+**every**. Pending timers are kept in a hierarchical timer wheel, with
+**TIMER_LEVELS** levels of **TIMER_SLOTS** slots each, where a slot in the
+first level holds the timers due in a particular millisecond, a slot in the
+second level those due within a particular span of 64 milliseconds, and so
+on. As time advances each slot of the first level is emptied onto a list of
+expired timers in turn, and whenever a level wraps around the next slot of
+the level above it is cascaded down into the levels below. Adding or
+cancelling a timer does not depend on how many there are, apart from the
+search that **cancel** does, and advancing the time is a step per
+millisecond. Timers further in the future than the wheel covers, about
+four and a half hours, are kept on a list that is looked at each time the
+top level wraps around.
+
+Time is taken from a monotonic clock where there is one, and from the
+processor time that **clock** uses otherwise.
+
+Expired timers are run by the virtual machine at a safe point, when a word
+defined with ':' is called, which is checked for every **TIMER_POLL** calls
+so the clock does not have to be read too often, and while waiting in
+**ms**, which sleeps until the next timer is due instead of spinning. A
+timer callback takes and returns nothing, and other timers are not run
+from inside of one. Timers are not part of the core, are not saved with it
+and are not recorded or replayed.
+**/
+#define TIMER_SLOT_BITS (6u)
+#define TIMER_SLOTS     (1u << TIMER_SLOT_BITS)
+#define TIMER_LEVELS    (4u)
+#define TIMER_POLL      (256u)
+
+struct timer {
+	struct timer *next;
+	uint64_t deadline;   /**< when it is due, in milliseconds */
+	forth_cell_t period; /**< zero for timers that only run once */
+	forth_cell_t xt;     /**< word to run */
+	forth_cell_t id;     /**< what **cancel** uses to find it */
+};
+
+enum timer_operation {
+	TIMER_AFTER, TIMER_EVERY, TIMER_CANCEL, TIMER_WAIT, TIMER_TICKS,
+	TIMER_LAST_OPERATION
+};
+
+struct timers {
+	uint64_t now;        /**< time the wheel has been advanced to */
+	forth_cell_t id;     /**< last id handed out */
+	forth_cell_t depth;  /**< return stack depth of a running callback */
+	forth_cell_t resume; /**< where the running callback returns to */
+	size_t count;        /**< timers in the wheel, not counting expired */
+	unsigned poll;       /**< calls left until the clock is next read */
+	bool running;        /**< a callback is running */
+	struct timer *expired, **expired_tail, *overflow;
+	struct timer *wheel[TIMER_LEVELS][TIMER_SLOTS];
+};
+
+static uint64_t timer_milliseconds(void)
+{
+#ifdef USE_MONOTONIC
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (uint64_t)t.tv_sec * 1000u + t.tv_nsec / 1000000u;
+#else
+	return ((uint64_t)clock() * 1000u) / CLOCKS_PER_SEC;
+#endif
+}
+
+static void timer_sleep(uint64_t ms)
+{
+#ifdef USE_MONOTONIC
+	struct timespec t = { .tv_sec = ms / 1000u, .tv_nsec = (ms % 1000u) * 1000000l };
+	nanosleep(&t, NULL);
+#else
+	(void)ms; /* there is no portable way to sleep, so we spin */
+#endif
+}
+
+static void timer_list_free(struct timer *t)
+{
+	while (t) {
+		struct timer *next = t->next;
+		free(t);
+		t = next;
+	}
+}
+
+static void timers_free(struct timers *t)
+{
+	if (!t)
+		return;
+	for (unsigned i = 0; i < TIMER_LEVELS; i++)
+		for (unsigned j = 0; j < TIMER_SLOTS; j++)
+			timer_list_free(t->wheel[i][j]);
+	timer_list_free(t->expired);
+	timer_list_free(t->overflow);
+	free(t);
+}
+
+/**
+A timer goes into the lowest level in which its deadline and the current
+time fall into the same turn of the level above, so its slot is always
+reached, or cascaded down, before the level wraps around.
+**/
+static void timer_insert(struct timers *t, struct timer *tm)
+{
+	struct timer **slot = &t->overflow;
+	if (tm->deadline <= t->now) {
+		tm->next = NULL;
+		*t->expired_tail = tm;
+		t->expired_tail = &tm->next;
+		return;
+	}
+	for (unsigned level = 0; level < TIMER_LEVELS; level++)
+		if ((tm->deadline >> (TIMER_SLOT_BITS * (level + 1))) == 
+				(t->now >> (TIMER_SLOT_BITS * (level + 1)))) {
+			slot = &t->wheel[level][(tm->deadline >>
+				(TIMER_SLOT_BITS * level)) & (TIMER_SLOTS - 1)];
+			break;
+		}
+	tm->next = *slot;
+	*slot = tm;
+	t->count++;
+}
+
+static void timer_cascade(struct timers *t, struct timer **slot)
+{
+	struct timer *tm = *slot;
+	*slot = NULL;
+	while (tm) {
+		struct timer *next = tm->next;
+		t->count--;
+		timer_insert(t, tm);
+		tm = next;
+	}
+}
+
+static void timer_advance(struct timers *t, uint64_t now)
+{
+	if (!t->count && now > t->now)
+		t->now = now;
+	while (t->now < now) {
+		unsigned level = 1;
+		t->now++;
+		for (; level < TIMER_LEVELS; level++) {
+			uint64_t span = (uint64_t)1 << (TIMER_SLOT_BITS * level);
+			if (t->now & (span - 1))
+				break;
+			timer_cascade(t, &t->wheel[level][(t->now / span)
+					& (TIMER_SLOTS - 1)]);
+		}
+		if (level == TIMER_LEVELS)
+			timer_cascade(t, &t->overflow);
+		timer_cascade(t, &t->wheel[0][t->now & (TIMER_SLOTS - 1)]);
+		if (!t->count && now > t->now)
+			t->now = now;
+	}
+}
+
+/**
+**timer_next** returns the time at which the wheel next needs looking at,
+when a timer in the first level is due or when the first level wraps
+around and another slot is cascaded down into it.
+**/
+static uint64_t timer_next(struct timers *t)
+{
+	uint64_t end = (t->now | (TIMER_SLOTS - 1)) + 1;
+	if (!t->count)
+		return UINT64_MAX;
+	for (uint64_t i = t->now + 1; i < end; i++)
+		if (t->wheel[0][i & (TIMER_SLOTS - 1)])
+			return i;
+	return end;
+}
+
+static forth_cell_t timer_add(forth_t *o, forth_cell_t ms, forth_cell_t xt, 
+		bool periodic)
+{
+	struct timer *tm;
+	if (!o->timers) {
+		if (!(o->timers = calloc(1, sizeof(*o->timers))))
+			return 0;
+		o->timers->expired_tail = &o->timers->expired;
+		o->timers->now = timer_milliseconds();
+		o->timers->poll = TIMER_POLL;
+	}
+	if (!(tm = calloc(1, sizeof(*tm))))
+		return 0;
+	timer_advance(o->timers, timer_milliseconds());
+	tm->deadline = o->timers->now + (ms ? ms : 1);
+	tm->period = periodic ? (ms ? ms : 1) : 0;
+	tm->xt = xt;
+	tm->id = ++o->timers->id;
+	timer_insert(o->timers, tm);
+	return tm->id;
+}
+
+static bool timer_remove(struct timer **list, forth_cell_t id, 
+		struct timer ***tail)
+{
+	for (struct timer **p = list; *p; p = &(*p)->next)
+		if ((*p)->id == id) {
+			struct timer *tm = *p;
+			*p = tm->next;
+			if (tail && *tail == &tm->next)
+				*tail = p;
+			free(tm);
+			return true;
+		}
+	return false;
+}
+
+static void timer_cancel(struct timers *t, forth_cell_t id)
+{
+	if (!t)
+		return;
+	if (timer_remove(&t->expired, id, &t->expired_tail))
+		return;
+	if (timer_remove(&t->overflow, id, NULL)) {
+		t->count--;
+		return;
+	}
+	for (unsigned i = 0; i < TIMER_LEVELS; i++)
+		for (unsigned j = 0; j < TIMER_SLOTS; j++)
+			if (timer_remove(&t->wheel[i][j], id, NULL)) {
+				t->count--;
+				return;
+			}
+}
+
+/**
+**timer_due** is called at a safe point with the return stack pointer
+and the place the callback would return to, and returns the execution
+token of a timer that should be run now, or zero. A running callback has
+finished once the return stack no longer holds the place it returns to.
+**/
+static forth_cell_t timer_due(struct timers *t, forth_cell_t *m, 
+		forth_cell_t R, forth_cell_t I)
+{
+	struct timer *tm;
+	forth_cell_t xt;
+	t->poll = TIMER_POLL;
+	if (t->running && R > t->depth && m[t->depth] == t->resume)
+		return 0;
+	t->running = false;
+	if (!t->expired)
+		timer_advance(t, timer_milliseconds());
+	if (!(tm = t->expired))
+		return 0;
+	if (!(t->expired = tm->next))
+		t->expired_tail = &t->expired;
+	xt = tm->xt;
+	if (tm->period) {
+		tm->deadline += tm->period;
+		if (tm->deadline <= t->now)
+			tm->deadline = t->now + tm->period;
+		timer_insert(t, tm);
+	} else {
+		free(tm);
+	}
+	if (t->expired)
+		t->poll = 1;
+	t->running = true;
+	t->depth = R + 1;
+	t->resume = I;
+	return xt;
+}
+
+/**
+**timer_wait** waits until **deadline**, by the clock **ticks** uses, or
+until a timer is due, whichever comes first.
+**/
+static void timer_wait(struct timers *t, forth_cell_t deadline)
+{
+	uint64_t now = timer_milliseconds(), until = deadline;
+	if (t) {
+		timer_advance(t, now);
+		t->poll = 1;
+		if (t->expired && !t->running)
+			return;
+		if (timer_next(t) < until)
+			until = timer_next(t);
+	}
+	if (until > now)
+		timer_sleep(until - now);
+}
+
 /** 
 ## API related functions and Initialization code 
 **/
 
+/**
+Each time the input is set it is treated as a new source, and the line
+count starts again, this is used to work out where code was compiled from.
+**/
+static void new_source(forth_t *o)
+{
+	o->source = ++o->sources;
+	o->line   = 1;
+}
+
 void forth_set_file_input(forth_t *o, FILE *in)
 {
 	assert(o); 
 	assert(in);
+	new_source(o);
 	o->unget_set    = false; /* discard character of push back */
 	o->m[SOURCE_ID] = FILE_IN;
 	o->m[FIN]       = (forth_cell_t)in;
@@ -1540,6 +2182,7 @@ void forth_set_block_input(forth_t *o, const char *s, size_t length)
 {
 	assert(o);
 	assert(s);
+	new_source(o);
 	o->unget_set = false;        /* discard character of push back */
 	o->m[SIDX] = 0;              /* m[SIDX] == start of string input */
 	o->m[SLEN] = length;         /* m[SLEN] == string len */
@@ -1607,71 +2250,597 @@ void forth_set_debug_level(forth_t *o, enum forth_debug_level level)
 	o->m[DEBUG] = level;
 }
 
-FILE *forth_fopen_or_die(const char *name, char *mode)
+/**
+When profiling is turned on the virtual machine counts how many times each
+word defined with **RUN** is called, the counts are kept outside of the
+Forth core, in a table indexed by the words **CODE** field address, so the
+core image is not changed by profiling it.
+**/
+int forth_set_profiling(forth_t *o, int enable)
 {
-	FILE *file;
-	assert(name);
-	assert(mode);
+	assert(o);
+	if (!enable) {
+		free(o->profile);
+		o->profile = NULL;
+		return 0;
+	}
+	if (o->profile)
+		return 0;
 	errno = 0;
-	file = fopen(name, mode);
-	if (!file) {
-		fatal("opening file \"%s\" => %s", name, forth_strerror());
-		exit(EXIT_FAILURE);
+	if (!(o->profile = calloc(o->core_size, sizeof(forth_cell_t)))) {
+		error("profile allocation failed, %s", forth_strerror());
+		return -1;
 	}
-	return file;
+	return 0;
 }
 
 /**
-@brief This function defaults all of the registers in a Forth environment
-and sets up the input and output streams.
-
-@param o     the forth environment to set up
-@param size  the size of the **m** field in **o**
-@param in    the input file
-@param out   the output file
-
-**forth_make_default** default is called by **forth_init** and
-**forth_load_core_file**, it is a routine which deals that sets up registers for
-the virtual machines memory, and especially with values that may only be
-valid for a limited period (such as pointers to **stdin**). 
+**forth_profile_report** prints out the words sorted by how often they were
+called, hottest first, along with their address and how many cells each
+one takes up (including their header). If source locations are being
+recorded the source and line each word was defined on is printed as well,
+otherwise these are zero. It finishes with a summary of how
+many pages of memory the words that were called at all are spread over,
+compared to how many they would take up if they were next to each other.
+
+It is not possible to move the words around in the dictionary when saving
+a core, which would be the natural next step. A cell in the core is just a
+number, it could be a reference to a word in a definition, a literal, or
+data in a variable holding an execution token, and there is no way to tell
+them apart in general. The report can instead be used to decide which
+words should be defined together, and early on, in the source.
 **/
-static void forth_make_default(forth_t *o, size_t size, FILE *in, FILE *out)
-{
-	assert(o && size >= MINIMUM_CORE_SIZE && in && out);
-	o->core_size     = size;
-	o->m[STACK_SIZE] = size / MINIMUM_STACK_SIZE > MINIMUM_STACK_SIZE ?
-				size / MINIMUM_STACK_SIZE :
-				MINIMUM_STACK_SIZE;
+struct word_profile {
+	forth_cell_t count, /**< number of times word was called */
+		     pwd,   /**< address of word's PWD field */
+		     size;  /**< size of word in cells, including header */
+};
 
-	o->s             = (uint8_t*)(o->m + STRING_OFFSET); /*skip registers*/
-	o->m[FOUT]       = (forth_cell_t)out;
-	o->m[START_ADDR] = (forth_cell_t)&(o->m);
-	o->m[STDIN]      = (forth_cell_t)stdin;
-	o->m[STDOUT]     = (forth_cell_t)stdout;
-	o->m[STDERR]     = (forth_cell_t)stderr;
-	o->m[RSTK] = size - o->m[STACK_SIZE]; /* set up return stk ptr */
-	o->m[ARGC] = o->m[ARGV] = 0;
-	o->S       = o->m + size - (2 * o->m[STACK_SIZE]); /* v. stk pointer */
-	o->vstart  = o->m + size - (2 * o->m[STACK_SIZE]);
-	o->vend    = o->vstart + o->m[STACK_SIZE];
-	forth_set_file_input(o, in);  /* set up input after our eval */
+static int word_profile_compare(const void *a, const void *b)
+{
+	const struct word_profile *x = a, *y = b;
+	if (x->count != y->count)
+		return x->count < y->count ? 1 : -1;
+	return x->pwd < y->pwd ? -1 : x->pwd > y->pwd;
 }
 
-/**
-@brief This function simply copies the current Forth header into a byte
-array, filling in the endianess which can only be determined at run time.
-@param dst a byte array at least "sizeof header" large 
-**/
-static void make_header(uint8_t *dst, uint8_t log2size)
+int forth_profile_report(forth_t *o, FILE *out)
 {
-	memcpy(dst, header, sizeof header);
-	/*fill in endianess, needs to be done at run time */
-	dst[ENDIAN] = !IS_BIG_ENDIAN;
-	dst[LOG2_SIZE] = log2size;
+	assert(o && out);
+	forth_cell_t *m = o->m, pwd, end = m[DIC], words = 0, i, j;
+	forth_cell_t hot = 0, hot_cells = 0, spread = 0;
+	const forth_cell_t page = 4096 / sizeof(forth_cell_t);
+	struct word_profile *p = NULL;
+	uint8_t *touched = NULL;
+	if (!o->profile || forth_is_invalid(o))
+		return -1;
+	for (pwd = m[PWD]; pwd > DICTIONARY_START; pwd = m[pwd])
+		words++;
+	p = calloc(words + 1, sizeof(*p));
+	touched = calloc(o->core_size / page + 1, 1);
+	if (!p || !touched)
+		goto fail;
+	for (i = 0, pwd = m[PWD]; pwd > DICTIONARY_START; pwd = m[pwd], i++) {
+		forth_cell_t start = pwd - WORD_LENGTH(m[pwd + 1]);
+		p[i].count = o->profile[pwd + 1];
+		p[i].pwd   = pwd;
+		p[i].size  = end - start;
+		end = start;
+	}
+	qsort(p, words, sizeof(*p), word_profile_compare);
+	fputs("count\txt\tcells\tname\tsource\tline\n", out);
+	for (i = 0; i < words && p[i].count; i++) {
+		forth_cell_t start = p[i].pwd - WORD_LENGTH(m[p[i].pwd + 1]);
+		forth_cell_t source = 0, line = 0;
+		if (forth_source_location(o, p[i].pwd + 1, &source, &line) < 0)
+			source = line = 0;
+		for (j = start / page; j <= (start + p[i].size - 1) / page; j++)
+			if (!touched[j]++)
+				spread++;
+		hot++;
+		hot_cells += p[i].size;
+		fprintf(out, "%"PRIdCell"\t%"PRIdCell"\t%"PRIdCell"\t%s\t"
+				"%"PRIdCell"\t%"PRIdCell"\n", 
+				p[i].count, p[i].pwd + 1, p[i].size, 
+				(char*)(&m[start]), source, line);
+	}
+	fprintf(out, "( %"PRIdCell" of %"PRIdCell" words called, "
+			"%"PRIdCell" cells on %"PRIdCell" pages, "
+			"%"PRIdCell" pages if packed )\n", 
+			hot, words, hot_cells, spread, 
+			(hot_cells + page - 1) / page);
+	free(touched);
+	free(p);
+	return 0;
+fail:
+	error("profile report allocation failed, %s", forth_strerror());
+	free(touched);
+	free(p);
+	return -1;
 }
 
 /**
-Calculates the binary logarithm of a forth cell, rounder up towards infinity.
+The source location table maps ranges of the dictionary back to the line
+they were compiled from. Storing the locations inline in the dictionary
+would change the layout of compiled code, so they are kept in a separate,
+growable, table. An entry is only made when the line changes, so the table
+stays small. The dictionary pointer can move backwards (with "marker", for
+example), in which case entries past it are discarded first.
+**/
+int forth_set_source_locations(forth_t *o, int enable)
+{
+	assert(o);
+	if (enable && o->locations)
+		return 0;
+	free(o->locations);
+	o->locations = NULL;
+	o->location_count = 0;
+	o->location_max   = 0;
+	if (!enable)
+		return 0;
+	errno = 0;
+	if (!(o->locations = calloc(64, sizeof(*o->locations)))) {
+		error("location table allocation failed, %s", forth_strerror());
+		return -1;
+	}
+	o->location_max = 64;
+	return 0;
+}
+
+/**
+**record_location** is called by the **READ** instruction before each word
+is processed, with the current dictionary pointer, everything compiled
+from then on belongs to the current line. If the table cannot be grown
+we stop recording and the table is left as it is.
+**/
+static void record_location(forth_t *o, forth_cell_t address)
+{
+	struct forth_location *l = o->locations;
+	size_t n = o->location_count;
+	while (n && l[n - 1].address > address)
+		n--;
+	o->location_count = n;
+	if (n && l[n - 1].source == o->source && l[n - 1].line == o->line)
+		return;
+	if (n && l[n - 1].address == address)
+		n--; /* nothing was compiled for the previous entry */
+	if (n == o->location_max) {
+		size_t max = o->location_max * 2;
+		errno = 0;
+		if (!(l = realloc(l, max * sizeof(*l)))) {
+			warning("location table full, %s", forth_strerror());
+			return;
+		}
+		o->locations    = l;
+		o->location_max = max;
+	}
+	l[n].address = address;
+	l[n].source  = o->source;
+	l[n].line    = o->line;
+	o->location_count = n + 1;
+}
+
+int forth_source_location(forth_t *o, forth_cell_t address, 
+		forth_cell_t *source, forth_cell_t *line)
+{
+	assert(o && source && line);
+	struct forth_location *l = o->locations;
+	size_t low = 0, high = o->location_count;
+	if (!l || !high || address < l[0].address || address >= o->m[DIC])
+		return -1;
+	while (high - low > 1) { /* find last entry at or before address */
+		size_t mid = low + (high - low) / 2;
+		if (l[mid].address <= address)
+			low = mid;
+		else
+			high = mid;
+	}
+	*source = l[low].source;
+	*line   = l[low].line;
+	return 0;
+}
+
+forth_cell_t forth_source_id(forth_t *o)
+{
+	assert(o);
+	return o->source;
+}
+
+/**
+The footprint functions look at how the core is being used, so the core
+size can be chosen on something better than guesswork. The dictionary is
+walked from the newest word to the oldest, each word runs from the start of
+its name to the start of the next word's name (or to the dictionary
+pointer), its header being its name, **PWD** and **CODE** fields and its
+body everything after that. Code compiled before the first word is defined
+is counted as part of the dictionary only.
+
+The stacks are not instrumented, instead, as the core is zeroed when it is
+allocated, the highest non-zero cell in each stack gives its high water
+mark. A zero pushed as the deepest item will not be seen, so this is an
+estimate, albeit one that costs nothing when not being used.
+**/
+static forth_cell_t high_water(const forth_cell_t *stack, forth_cell_t size)
+{
+	for (; size; size--)
+		if (stack[size - 1])
+			return size - 1;
+	return 0;
+}
+
+int forth_footprint(forth_t *o, struct forth_footprint *fp)
+{
+	assert(o && fp);
+	forth_cell_t *m = o->m, pwd, end = m[DIC], i;
+	if (forth_is_invalid(o))
+		return -1;
+	memset(fp, 0, sizeof(*fp));
+	fp->core       = o->core_size;
+	fp->dictionary = m[DIC] - DICTIONARY_START;
+	fp->unused     = (forth_cell_t)(o->vstart - m) - m[DIC];
+	fp->stack_size = m[STACK_SIZE];
+	for (pwd = m[PWD]; pwd > DICTIONARY_START; pwd = m[pwd]) {
+		forth_cell_t start = pwd - WORD_LENGTH(m[pwd + 1]);
+		fp->words++;
+		fp->headers += pwd + 2 - start;
+		fp->bodies  += end - (pwd + 2);
+		end = start;
+	}
+	fp->variable_stack_max = high_water(o->vstart, m[STACK_SIZE]);
+	fp->return_stack_max = 
+		high_water(m + o->core_size - m[STACK_SIZE], m[STACK_SIZE]);
+	for (i = 0; i < o->core_size; i++)
+		fp->non_zero += !!m[i];
+	return 0;
+}
+
+/**
+**forth_footprint_report** prints out the summary from **forth_footprint**,
+optionally preceded by the size of each word. If source locations are being
+recorded the source and line a word was defined on are printed next to it,
+and the words are totaled up per source as well, the line numbers can be
+used to total words up by the sections of a file.
+**/
+int forth_footprint_report(forth_t *o, FILE *out, int words)
+{
+	assert(o && out);
+	forth_cell_t *m = o->m, pwd, end = m[DIC], i;
+	forth_cell_t *sources = NULL, nsources = o->sources + 1;
+	struct forth_footprint fp;
+	if (forth_footprint(o, &fp) < 0)
+		return -1;
+	if (words && o->locations) {
+		errno = 0;
+		if (!(sources = calloc(nsources * 3, sizeof(*sources)))) {
+			error("footprint report failed, %s", forth_strerror());
+			return -1;
+		}
+	}
+	if (words)
+		fputs("header\tbody\txt\tname\tsource\tline\n", out);
+	for (pwd = m[PWD]; words && pwd > DICTIONARY_START; pwd = m[pwd]) {
+		forth_cell_t start = pwd - WORD_LENGTH(m[pwd + 1]);
+		forth_cell_t source = 0, line = 0;
+		if (forth_source_location(o, pwd + 1, &source, &line) < 0
+				|| source >= nsources)
+			source = line = 0;
+		if (sources) {
+			sources[source * 3]++;
+			sources[source * 3 + 1] += pwd + 2 - start;
+			sources[source * 3 + 2] += end - (pwd + 2);
+		}
+		fprintf(out, "%"PRIdCell"\t%"PRIdCell"\t%"PRIdCell"\t%s\t"
+				"%"PRIdCell"\t%"PRIdCell"\n",
+				pwd + 2 - start, end - (pwd + 2), pwd + 1,
+				(char*)(&m[start]), source, line);
+		end = start;
+	}
+	if (sources) {
+		fputs("source\twords\theader\tbody\n", out);
+		for (i = 0; i < nsources; i++)
+			if (sources[i * 3])
+				fprintf(out, "%"PRIdCell"\t%"PRIdCell"\t"
+						"%"PRIdCell"\t%"PRIdCell"\n", i,
+						sources[i * 3], sources[i * 3 + 1],
+						sources[i * 3 + 2]);
+		free(sources);
+	}
+	fprintf(out, "core:            %"PRIdCell"\n", fp.core);
+	fprintf(out, "words:           %"PRIdCell"\n", fp.words);
+	fprintf(out, "dictionary:      %"PRIdCell"\n", fp.dictionary);
+	fprintf(out, "  headers:       %"PRIdCell"\n", fp.headers);
+	fprintf(out, "  bodies:        %"PRIdCell"\n", fp.bodies);
+	fprintf(out, "unused:          %"PRIdCell"\n", fp.unused);
+	fprintf(out, "stack size:      %"PRIdCell"\n", fp.stack_size);
+	fprintf(out, "  variable max:  %"PRIdCell"\n", fp.variable_stack_max);
+	fprintf(out, "  return max:    %"PRIdCell"\n", fp.return_stack_max);
+	fprintf(out, "non-zero:        %"PRIdCell"\n", fp.non_zero);
+	return 0;
+}
+
+/**
+The allocation profiler keeps track of every block handed out by
+**ALLOCATE** and **RESIZE** that has not yet been passed to **FREE**, and
+of how much each word has allocated. A block is charged to the word that
+was executing when it was allocated, which is the word whose definition
+the instruction pointer is inside of, found by walking the dictionary
+for the closest header below it. Blocks allocated from the top level
+interpreter, or with the profiler off, belong to no word at all.
+
+The tables are searched linearly, this is a debugging aid and the number
+of live blocks and allocating words are expected to be small.
+**/
+struct heap_site {
+	forth_cell_t pwd;         /**< word charged, or zero for none */
+	forth_cell_t allocations; /**< number of blocks allocated */
+	forth_cell_t frees;       /**< number of blocks freed */
+	forth_cell_t bytes;       /**< total bytes allocated */
+	forth_cell_t live;        /**< bytes allocated but not freed */
+	forth_cell_t blocks;      /**< blocks allocated but not freed */
+};
+
+struct heap_block {
+	forth_cell_t address; /**< address returned by the C library */
+	forth_cell_t size;    /**< size requested */
+	size_t site;          /**< index of allocating word in site table */
+};
+
+struct heap_profile {
+	struct heap_site *sites;   /**< per word allocation statistics */
+	size_t site_count, site_max;
+	struct heap_block *blocks; /**< blocks that are still allocated */
+	size_t block_count, block_max;
+};
+
+static void heap_profile_free(struct heap_profile *h)
+{
+	if (!h)
+		return;
+	free(h->sites);
+	free(h->blocks);
+	free(h);
+}
+
+int forth_set_allocation_profiling(forth_t *o, int enable)
+{
+	assert(o);
+	if (!enable) {
+		heap_profile_free(o->heap);
+		o->heap = NULL;
+		return 0;
+	}
+	if (o->heap)
+		return 0;
+	errno = 0;
+	if (!(o->heap = calloc(1, sizeof(*o->heap)))) {
+		error("allocation profile failed, %s", forth_strerror());
+		return -1;
+	}
+	return 0;
+}
+
+/**
+**word_containing** returns the **PWD** field of the word whose definition
+contains **address**, the dictionary is a linked list going from the
+newest (highest) word to the oldest, so the first header below the address
+is the one we want.
+**/
+static forth_cell_t word_containing(forth_t *o, forth_cell_t address)
+{
+	forth_cell_t *m = o->m, pwd;
+	if (address >= m[DIC])
+		return 0;
+	for (pwd = m[PWD]; pwd > DICTIONARY_START; pwd = m[pwd])
+		if (pwd < address)
+			return pwd;
+	return 0;
+}
+
+static const char *word_name(forth_t *o, forth_cell_t pwd)
+{
+	if (!pwd)
+		return "(none)";
+	return (char*)(&o->m[pwd - WORD_LENGTH(o->m[pwd + 1])]);
+}
+
+/**
+**heap_allocated** and **heap_freed** are called by the virtual machine
+after a successful allocation or before a free, **ip** is the instruction
+pointer at the time. A failure to grow a table turns the profiler off,
+rather than leaving it with an incomplete picture.
+**/
+static void heap_allocated(forth_t *o, forth_cell_t address, 
+		forth_cell_t size, forth_cell_t ip)
+{
+	struct heap_profile *h = o->heap;
+	forth_cell_t pwd = word_containing(o, ip);
+	size_t i;
+	for (i = 0; i < h->site_count; i++)
+		if (h->sites[i].pwd == pwd)
+			break;
+	if (i == h->site_max || h->block_count == h->block_max) {
+		size_t smax = h->site_max ? h->site_max * 2 : 16;
+		size_t bmax = h->block_max ? h->block_max * 2 : 64;
+		struct heap_site *s;
+		struct heap_block *b;
+		errno = 0;
+		if (i == h->site_max) {
+			if (!(s = realloc(h->sites, smax * sizeof(*s))))
+				goto fail;
+			h->sites = s;
+			h->site_max = smax;
+		}
+		if (h->block_count == h->block_max) {
+			if (!(b = realloc(h->blocks, bmax * sizeof(*b))))
+				goto fail;
+			h->blocks = b;
+			h->block_max = bmax;
+		}
+	}
+	if (i == h->site_count) {
+		memset(&h->sites[i], 0, sizeof(h->sites[i]));
+		h->sites[i].pwd = pwd;
+		h->site_count++;
+	}
+	h->sites[i].allocations++;
+	h->sites[i].bytes  += size;
+	h->sites[i].live   += size;
+	h->sites[i].blocks++;
+	h->blocks[h->block_count].address = address;
+	h->blocks[h->block_count].size    = size;
+	h->blocks[h->block_count].site    = i;
+	h->block_count++;
+	return;
+fail:
+	warning("allocation profile disabled, %s", forth_strerror());
+	heap_profile_free(h);
+	o->heap = NULL;
+}
+
+static void heap_freed(forth_t *o, forth_cell_t address)
+{
+	struct heap_profile *h = o->heap;
+	size_t i;
+	if (!address)
+		return;
+	for (i = h->block_count; i; i--) { /* recent blocks die young */
+		struct heap_block *b = &h->blocks[i - 1];
+		if (b->address != address)
+			continue;
+		h->sites[b->site].frees++;
+		h->sites[b->site].live -= b->size;
+		h->sites[b->site].blocks--;
+		*b = h->blocks[--h->block_count];
+		return;
+	}
+}
+
+/**
+**forth_allocation_report** prints a line per word that has allocated
+memory, the word holding on to the most memory first, followed by a
+summary of how much is still allocated.
+**/
+static int heap_site_compare(const void *a, const void *b)
+{
+	const struct heap_site *x = a, *y = b;
+	if (x->live != y->live)
+		return x->live < y->live ? 1 : -1;
+	if (x->bytes != y->bytes)
+		return x->bytes < y->bytes ? 1 : -1;
+	return x->pwd < y->pwd ? -1 : x->pwd > y->pwd;
+}
+
+int forth_allocation_report(forth_t *o, FILE *out)
+{
+	assert(o && out);
+	struct heap_profile *h = o->heap;
+	struct heap_site *s;
+	forth_cell_t live = 0;
+	size_t i;
+	if (!h || forth_is_invalid(o))
+		return -1;
+	errno = 0;
+	if (!(s = malloc((h->site_count + 1) * sizeof(*s)))) {
+		error("allocation report failed, %s", forth_strerror());
+		return -1;
+	}
+	memcpy(s, h->sites, h->site_count * sizeof(*s));
+	qsort(s, h->site_count, sizeof(*s), heap_site_compare);
+	fputs("allocations\tfrees\tbytes\tlive\tblocks\tname\n", out);
+	for (i = 0; i < h->site_count; i++) {
+		live += s[i].live;
+		fprintf(out, "%"PRIdCell"\t%"PRIdCell"\t%"PRIdCell"\t"
+				"%"PRIdCell"\t%"PRIdCell"\t%s\n",
+				s[i].allocations, s[i].frees, s[i].bytes,
+				s[i].live, s[i].blocks, word_name(o, s[i].pwd));
+	}
+	fprintf(out, "( %"PRIdCell" bytes in %"PRIdCell" blocks allocated )\n",
+			live, (forth_cell_t)h->block_count);
+	free(s);
+	return 0;
+}
+
+/**
+**heap_leaks** is called from **forth_free**, any block still allocated is
+about to become unreachable, as nothing outside of the Forth core can
+refer to it. Only a summary per word is printed.
+**/
+static void heap_leaks(forth_t *o)
+{
+	struct heap_profile *h = o->heap;
+	size_t i;
+	for (i = 0; i < h->site_count; i++)
+		if (h->sites[i].blocks)
+			warning("%"PRIdCell" bytes in %"PRIdCell" blocks "
+				"leaked by '%s'", h->sites[i].live, 
+				h->sites[i].blocks, word_name(o, h->sites[i].pwd));
+}
+
+FILE *forth_fopen_or_die(const char *name, char *mode)
+{
+	FILE *file;
+	assert(name);
+	assert(mode);
+	errno = 0;
+	file = fopen(name, mode);
+	if (!file) {
+		fatal("opening file \"%s\" => %s", name, forth_strerror());
+		exit(EXIT_FAILURE);
+	}
+	return file;
+}
+
+/**
+@brief This function defaults all of the registers in a Forth environment
+and sets up the input and output streams.
+
+@param o     the forth environment to set up
+@param size  the size of the **m** field in **o**
+@param in    the input file
+@param out   the output file
+
+**forth_make_default** default is called by **forth_init** and
+**forth_load_core_file**, it is a routine which deals that sets up registers for
+the virtual machines memory, and especially with values that may only be
+valid for a limited period (such as pointers to **stdin**). 
+**/
+static void forth_make_default(forth_t *o, size_t size, FILE *in, FILE *out)
+{
+	assert(o && size >= MINIMUM_CORE_SIZE && in && out);
+	o->core_size     = size;
+	o->m[STACK_SIZE] = size / MINIMUM_STACK_SIZE > MINIMUM_STACK_SIZE ?
+				size / MINIMUM_STACK_SIZE :
+				MINIMUM_STACK_SIZE;
+
+	o->s             = (uint8_t*)(o->m + STRING_OFFSET); /*skip registers*/
+	o->m[FOUT]       = (forth_cell_t)out;
+	o->m[START_ADDR] = (forth_cell_t)&(o->m);
+	o->m[STDIN]      = (forth_cell_t)stdin;
+	o->m[STDOUT]     = (forth_cell_t)stdout;
+	o->m[STDERR]     = (forth_cell_t)stderr;
+	o->m[RSTK] = size - o->m[STACK_SIZE]; /* set up return stk ptr */
+	o->m[ARGC] = o->m[ARGV] = 0;
+	o->S       = o->m + size - (2 * o->m[STACK_SIZE]); /* v. stk pointer */
+	o->vstart  = o->m + size - (2 * o->m[STACK_SIZE]);
+	o->vend    = o->vstart + o->m[STACK_SIZE];
+	forth_set_file_input(o, in);  /* set up input after our eval */
+}
+
+/**
+@brief This function simply copies the current Forth header into a byte
+array, filling in the endianess which can only be determined at run time.
+@param dst a byte array at least "sizeof header" large 
+**/
+static void make_header(uint8_t *dst, uint8_t log2size)
+{
+	memcpy(dst, header, sizeof header);
+	/*fill in endianess, needs to be done at run time */
+	dst[ENDIAN] = !IS_BIG_ENDIAN;
+	dst[LOG2_SIZE] = log2size;
+}
+
+/**
+Calculates the binary logarithm of a forth cell, rounder up towards infinity.
 This used for storing the size field in the header.
 **/
 forth_cell_t forth_blog2(forth_cell_t x)
@@ -1693,6 +2862,92 @@ forth_cell_t forth_round_up_pow2(forth_cell_t r)
 	return up;
 }
 
+/**
+**core_allocate** gets the memory for a Forth environment, including its
+core, which must be zeroed. Normally this is done with **calloc**, however
+for large cores on Unix systems the **options** can ask for the core to be
+backed by an anonymous mapping instead. With **FORTH_CORE_HUGE_PAGES** the
+mapping is aligned on a huge page boundary and the kernel is advised it
+should use transparent huge pages for it, reducing the number of TLB misses
+when the dictionary is accessed, and with **FORTH_CORE_PREFAULT** every page
+is faulted in now instead of on first use. The options are only hints, if
+they cannot be honored we fall back to **calloc**.
+
+**MAP_POPULATE** is not used when huge pages are wanted as it would fault
+in normal pages before the mapping could be advised, instead each page is
+written to after the advice is given.
+**/
+#define HUGE_PAGE_SIZE (2ul << 20)
+
+#ifdef USE_MMAP
+static void prefault(volatile uint8_t *p, size_t length)
+{
+	for (size_t i = 0; i < length; i += 4096)
+		p[i] = 0;
+}
+#endif
+
+static forth_t *core_allocate(size_t bytes, unsigned options)
+{
+#ifdef USE_MMAP
+	if (options & (FORTH_CORE_HUGE_PAGES | FORTH_CORE_PREFAULT)) {
+		const bool huge = options & FORTH_CORE_HUGE_PAGES;
+		const size_t align = huge ? HUGE_PAGE_SIZE : 0;
+		size_t length = huge ? 
+			(bytes + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1) : bytes;
+		int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+		bool populated = false;
+		uint8_t *p;
+#ifdef MAP_POPULATE
+		if (!huge && (options & FORTH_CORE_PREFAULT)) {
+			flags |= MAP_POPULATE;
+			populated = true;
+		}
+#endif
+		errno = 0;
+		p = mmap(NULL, length + align, PROT_READ | PROT_WRITE, 
+				flags, -1, 0);
+		if (p == MAP_FAILED) {
+			warning("core mapping failed, %s", forth_strerror());
+			return calloc(1, bytes);
+		}
+		if (huge) { /* trim mapping down to an aligned region */
+			uintptr_t start = ((uintptr_t)p + align - 1) & ~(align - 1);
+			size_t head = start - (uintptr_t)p;
+			if (head)
+				munmap(p, head);
+			if (align - head)
+				munmap((uint8_t*)start + length, align - head);
+			p = (uint8_t*)start;
+#ifdef MADV_HUGEPAGE
+			if (madvise(p, length, MADV_HUGEPAGE) < 0)
+				warning("huge pages not available, %s", 
+						forth_strerror());
+#endif
+		}
+		if ((options & FORTH_CORE_PREFAULT) && !populated)
+			prefault(p, length);
+		((forth_t*)p)->mapped = length;
+		return (forth_t*)p;
+	}
+#else
+	if (options & (FORTH_CORE_HUGE_PAGES | FORTH_CORE_PREFAULT))
+		warning("core options %x not supported", options);
+#endif
+	return calloc(1, bytes);
+}
+
+static void core_release(forth_t *o)
+{
+#ifdef USE_MMAP
+	if (o && o->mapped) {
+		munmap(o, o->mapped);
+		return;
+	}
+#endif
+	free(o);
+}
+
 /**
 **forth_init** is a complex function that returns a fully initialized forth
 environment we can start executing Forth in, it does the usual task of
@@ -1702,6 +2957,12 @@ task of getting the object into a runnable state so we can pass it to
 **/
 forth_t *forth_init(size_t size, FILE *in, FILE *out, 
 		const struct forth_functions *calls)
+{
+	return forth_init_with_options(size, in, out, calls, 0);
+}
+
+forth_t *forth_init_with_options(size_t size, FILE *in, FILE *out, 
+		const struct forth_functions *calls, unsigned options)
 {
 	forth_cell_t *m, i, w, t, pow;
 	forth_t *o;
@@ -1733,7 +2994,7 @@ if we are passed a lower number the programmer has made a mistake somewhere
 and should be informed of this problem.
 **/
 	VERIFY(size >= MINIMUM_CORE_SIZE);
-	if (!(o = calloc(1, sizeof(*o) + sizeof(forth_cell_t)*size)))
+	if (!(o = core_allocate(sizeof(*o) + sizeof(forth_cell_t)*size, options)))
 		return NULL;
 
 /** 
@@ -1861,6 +3122,74 @@ int forth_dump_core(forth_t *o, FILE *dump)
 	return w != fwrite(o, 1, w, dump) ? -1: 0;
 }
 
+/**
+**forth_dump_memory** prints out a region of the core as text, a line at a
+time, each line holding the address of the first cell on it and then
+**DUMP_COLUMNS** cells, optionally followed by the characters that make up
+those cells (in the order they are in memory, with anything that is not
+printable replaced by a '.'). Numbers are printed in **base**, zero padded
+to the width of the largest cell unless printing in decimal. This is used
+by the **(dump)** instruction, and so "dump", dumping a large core formatted
+a cell at a time by Forth code would take far too long.
+**/
+#define DUMP_COLUMNS (4)
+
+static size_t format_cell(char *d, forth_cell_t v, unsigned base, 
+		unsigned width)
+{
+	char digits[sizeof(forth_cell_t) * CHAR_BIT];
+	size_t i = 0, j = 0;
+	do {
+		digits[i++] = "0123456789abcdefghijklmnopqrstuvwxyz"[v % base];
+		v /= base;
+	} while (v);
+	for (; j + i < width; j++)
+		d[j] = base == 10 ? ' ' : '0';
+	while (i)
+		d[j++] = digits[--i];
+	return j;
+}
+
+int forth_dump_memory(forth_t *o, FILE *out, forth_cell_t address, 
+		forth_cell_t count, unsigned base, int ascii)
+{
+	assert(o && out);
+	char line[(sizeof(forth_cell_t) * CHAR_BIT + 1) * (DUMP_COLUMNS + 1) 
+		+ sizeof(forth_cell_t) * DUMP_COLUMNS + 8];
+	unsigned width = 0;
+	if (base < 2 || base > 36)
+		return -1;
+	if (address >= o->core_size)
+		return 0;
+	if (count > o->core_size - address)
+		count = o->core_size - address;
+	for (forth_cell_t v = (forth_cell_t)-1; v; v /= base)
+		width++;
+	for (forth_cell_t i = 0; i < count; i += DUMP_COLUMNS) {
+		forth_cell_t n = count - i < DUMP_COLUMNS ? count - i : DUMP_COLUMNS;
+		size_t l = format_cell(line, address + i, base, width);
+		line[l++] = ':';
+		for (forth_cell_t j = 0; j < n; j++) {
+			line[l++] = ' ';
+			l += format_cell(line + l, o->m[address + i + j], base, width);
+		}
+		if (ascii) {
+			const uint8_t *c = (const uint8_t*)&o->m[address + i];
+			for (forth_cell_t j = n; j < DUMP_COLUMNS; j++)
+				for (unsigned k = 0; k <= width; k++)
+					line[l++] = ' ';
+			line[l++] = ' ';
+			line[l++] = ' ';
+			for (size_t j = 0; j < n * sizeof(forth_cell_t); j++)
+				line[l++] = isprint(c[j]) ? c[j] : '.';
+		}
+		line[l++] = '\n';
+		if (fwrite(line, 1, l, out) != l)
+			return -1;
+	}
+	return 0;
+}
+
 /** 
 We can save the virtual machines working memory in a way, called serialization,
 such that we can load the saved file back in and continue execution using this
@@ -1892,6 +3221,11 @@ are correct and compatible with this interpreter.
 in registers which are now invalid after we have loaded the file from disk.
 **/
 forth_t *forth_load_core_file(FILE *dump)
+{
+	return forth_load_core_file_with_options(dump, 0);
+}
+
+forth_t *forth_load_core_file_with_options(FILE *dump, unsigned options)
 { 
 	uint8_t actual[sizeof(header)] = {0},   /* read in header */
 		expected[sizeof(header)] = {0}; /* what we expected */
@@ -1913,7 +3247,7 @@ forth_t *forth_load_core_file(FILE *dump)
 	}
 	w = sizeof(*o) + (sizeof(forth_cell_t) * core_size);
 	errno = 0;
-	if (!(o = calloc(w, 1))) {
+	if (!(o = core_allocate(w, options))) {
 		error("allocation of size %"PRId64" failed, %s", w, forth_strerror());
 		goto fail; 
 	}
@@ -1927,7 +3261,7 @@ forth_t *forth_load_core_file(FILE *dump)
 	forth_make_default(o, core_size, stdin, stdout);
 	return o;
 fail:
-	free(o);
+	core_release(o);
 	return NULL;
 }
 
@@ -1986,8 +3320,20 @@ void forth_free(forth_t *o)
 	assert(o);
 	/* invalidate the forth core, a sufficiently "smart" compiler 
 	 * might optimize this out */
+	if (o->heap && !forth_is_invalid(o))
+		heap_leaks(o);
 	forth_invalidate(o);
-	free(o);
+	free(o->profile);
+	heap_profile_free(o->heap);
+	screen_free(o->screen);
+	timers_free(o->timers);
+	free(o->locations);
+	while (o->strings) {
+		struct replayed_string *next = o->strings->next;
+		free(o->strings);
+		o->strings = next;
+	}
+	core_release(o);
 }
 
 /**
@@ -2044,78 +3390,1521 @@ void forth_push(forth_t *o, forth_cell_t f)
 	o->m[TOP] = f;
 }
 
-forth_cell_t forth_pop(forth_t *o)
+forth_cell_t forth_pop(forth_t *o)
+{
+	assert(o);
+	assert(o->S > o->m);
+	forth_cell_t f = o->m[TOP];
+	o->m[TOP] = *(o->S)--;
+	return f;
+}
+
+forth_cell_t forth_stack_position(forth_t *o)
+{
+	assert(o);
+	return o->S - o->vstart;
+}
+
+void forth_signal(forth_t *o, int sig)
+{
+	assert(o);
+	o->m[SIGNAL_HANDLER] = (forth_cell_t)((sig * -1) + BIAS_SIGNAL);
+}
+
+char *forth_strdup(const char *s)
+{
+	assert(s);
+	char *str;
+	if (!(str = malloc(strlen(s) + 1)))
+		return NULL;
+	strcpy(str, s);
+	return str;
+}
+
+void forth_free_words(char **s, size_t length)
+{
+	for (size_t i = 0; i < length; i++)
+		free(s[i]);
+	free(s);
+}
+
+char **forth_words(forth_t *o, size_t *length)
+{
+	assert(o);
+	assert(length);
+	forth_cell_t pwd = o->m[PWD];
+	forth_cell_t *m  = o->m;
+	size_t i;
+	char **n, **s = calloc(2, sizeof(*s));
+	if (!s)
+		return NULL;
+	for (i = 0 ;pwd > DICTIONARY_START; pwd = m[pwd], i++) {
+		forth_cell_t len = WORD_LENGTH(m[pwd + 1]);
+		s[i] = forth_strdup((char*)(&m[pwd-len]));
+		if (!s[i]) {
+			forth_free_words(s, i);
+			*length = 0;
+			return NULL;
+		}
+		n = realloc(s, sizeof(*s) * (i+2));
+		if (!n) {
+			forth_free_words(s, i);
+			*length = 0;
+			return NULL;
+		}
+		s = n;
+	}
+	*length = i;
+	return s;
+}
+
+/**
+**SYSTEM** uses **system**, which starts a shell for each command and lets
+the output go wherever the interpreter's output is going. On Unix systems
+commands can instead be run with **posix_spawnp**, with their standard
+output connected to a pipe that we read from. A command line is split into
+arguments on white space, single or double quotes can be used to group
+words into a single argument, no shell is involved unless it is asked for
+explicitly, for example with: 
+
+	sh -c 'ls | wc -l'
+
+**spawn_arguments** performs the splitting, returning an argument vector
+and the strings it points to in a single allocation.
+**/
+#ifdef USE_SPAWN
+static char **spawn_arguments(const char *s, size_t length)
+{
+	size_t max = length / 2 + 2, argc = 0, i = 0;
+	char **argv = malloc(max * sizeof(*argv) + length + 1);
+	char *d;
+	if (!argv)
+		return NULL;
+	d = (char*)(argv + max);
+	while (i < length) {
+		while (i < length && isspace((unsigned char)s[i]))
+			i++;
+		if (i == length)
+			break;
+		argv[argc++] = d;
+		for (char quote = 0; i < length; i++) {
+			if (quote && s[i] == quote) {
+				quote = 0;
+			} else if (!quote && (s[i] == '"' || s[i] == '\'')) {
+				quote = s[i];
+			} else if (!quote && isspace((unsigned char)s[i])) {
+				break;
+			} else {
+				*d++ = s[i];
+			}
+		}
+		*d++ = '\0';
+	}
+	argv[argc] = NULL;
+	if (!argc) {
+		free(argv);
+		errno = EINVAL;
+		return NULL;
+	}
+	return argv;
+}
+
+/**
+**spawn_piped** starts a command with its output going to a pipe, the read
+end of the pipe is returned in **fd**, it will not be inherited by any
+other processes we start. The return value is the process identifier, or
+negative with **errno** set on failure.
+**/
+static pid_t spawn_piped(const char *s, size_t length, int *fd)
+{
+	extern char **environ;
+	posix_spawn_file_actions_t actions;
+	char **argv = NULL;
+	int p[2] = { -1, -1 }, r = 0;
+	pid_t pid = -1;
+	if (!(argv = spawn_arguments(s, length)))
+		return -1;
+	if (pipe(p) < 0) {
+		free(argv);
+		return -1;
+	}
+	fcntl(p[0], F_SETFD, FD_CLOEXEC);
+	if (!(r = posix_spawn_file_actions_init(&actions))) {
+		if (!(r = posix_spawn_file_actions_adddup2(&actions, p[1], 1))
+		&&  !(r = posix_spawn_file_actions_addclose(&actions, p[1])))
+			r = posix_spawnp(&pid, argv[0], &actions, NULL, 
+					argv, environ);
+		posix_spawn_file_actions_destroy(&actions);
+	}
+	close(p[1]);
+	free(argv);
+	if (r) {
+		close(p[0]);
+		errno = r;
+		return -1;
+	}
+	*fd = p[0];
+	return pid;
+}
+
+/**
+**spawn_wait** reaps a child and turns its status into something more
+useful to a Forth program, its exit status if it exited normally and 128
+plus the signal number if it was killed, as a shell would.
+**/
+static forth_cell_t spawn_wait(pid_t pid)
+{
+	int status = 0;
+	while (waitpid(pid, &status, 0) < 0)
+		if (errno != EINTR)
+			return -1;
+	if (WIFEXITED(status))
+		return WEXITSTATUS(status);
+	if (WIFSIGNALED(status))
+		return 128 + WTERMSIG(status);
+	return -1;
+}
+
+static long spawn_milliseconds(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (long)t.tv_sec * 1000l + t.tv_nsec / 1000000l;
+}
+
+/**
+**spawn_capture** runs a command to completion, reading its output into
+**buf**, anything that does not fit is read and thrown away so the child is
+not left blocked writing to a full pipe. If **ms** is non zero and the
+command has not finished by then it is killed. The number of bytes stored
+is returned and the status of the child is written to **status**, which is
+-1 if it could not be started.
+**/
+static forth_cell_t spawn_capture(const char *s, size_t length, 
+		char *buf, size_t size, forth_cell_t ms, forth_cell_t *status)
+{
+	char discard[512];
+	size_t count = 0;
+	long deadline = spawn_milliseconds() + (long)ms;
+	int fd = -1;
+	pid_t pid = spawn_piped(s, length, &fd);
+	if (pid < 0) {
+		*status = -1;
+		return 0;
+	}
+	for (;;) {
+		struct pollfd p = { .fd = fd, .events = POLLIN };
+		int wait = -1;
+		ssize_t r;
+		if (ms) {
+			long left = deadline - spawn_milliseconds();
+			if (left <= 0) {
+				kill(pid, SIGKILL);
+				break;
+			}
+			wait = (int)left;
+		}
+		if ((r = poll(&p, 1, wait)) < 0 && errno != EINTR)
+			break;
+		if (r <= 0)
+			continue;
+		if (count < size)
+			r = read(fd, buf + count, size - count);
+		else
+			r = read(fd, discard, sizeof(discard));
+		if (r < 0 && errno == EINTR)
+			continue;
+		if (r <= 0)
+			break;
+		if (count < size)
+			count += r;
+	}
+	close(fd);
+	*status = spawn_wait(pid);
+	return count;
+}
+#endif
+
+/**
+## LZ Compression
+
+The words **compress** and **decompress** implement a small LZ77 style
+codec, much like LZ4, which is fast enough that compressing a core file is
+limited by the speed of the disk. Compressed data is a series of sequences,
+each of which starts with a token byte; the upper four bits of the token are
+the number of literal bytes that follow the token, the lower four bits are
+the length of a match that follows the literals minus **LZ_MIN_MATCH**. If
+either of these is fifteen then more bytes follow the token (or the
+literals), each of which is added to the length, until a byte that is not
+255 is found. After the literals comes a two byte little endian offset back
+into the data already decompressed to copy the match from, and then any
+extra bytes of the match length. The final sequence contains only literals,
+and ends the data.
+
+The compressor uses a hash of the next four bytes to find the last place
+they appeared, it does not search any further than that, which is fast but
+does not find the best match. The decompressor checks everything it reads,
+as the data it is given could have come from anywhere.
+**/
+#define LZ_MIN_MATCH  (4)
+#define LZ_HASH_BITS  (12)
+#define LZ_MAX_OFFSET (65535)
+#define LZ_ERROR      ((size_t)-1)
+
+static uint32_t lz_read32(const uint8_t *s)
+{
+	uint32_t r;
+	memcpy(&r, s, sizeof(r));
+	return r;
+}
+
+static size_t lz_length(uint8_t *d, size_t n)
+{
+	size_t i = 0;
+	for (n -= 15; n >= 255; n -= 255)
+		d[i++] = 255;
+	d[i++] = n;
+	return i;
+}
+
+static size_t lz_sequence(uint8_t *d, size_t dn, const uint8_t *literals, 
+		size_t count, size_t offset, size_t match)
+{
+	size_t i = 0, m = match ? match - LZ_MIN_MATCH : 0;
+	if (1 + (count / 255 + 1) + count + 2 + (m / 255 + 1) > dn)
+		return LZ_ERROR;
+	d[i++] = ((count < 15 ? count : 15) << 4) | (m < 15 ? m : 15);
+	if (count >= 15)
+		i += lz_length(d + i, count);
+	memcpy(d + i, literals, count);
+	i += count;
+	if (!match)
+		return i;
+	d[i++] = offset & 0xff;
+	d[i++] = offset >> 8;
+	if (m >= 15)
+		i += lz_length(d + i, m);
+	return i;
+}
+
+static size_t lz_compress(const uint8_t *s, size_t n, uint8_t *d, size_t dn)
+{
+	uint32_t table[1 << LZ_HASH_BITS] = { 0 };
+	size_t i = 0, anchor = 0, o = 0, r;
+	while (n >= LZ_MIN_MATCH && i <= n - LZ_MIN_MATCH) {
+		uint32_t v = lz_read32(s + i);
+		uint32_t h = (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+		size_t c = table[h], m = LZ_MIN_MATCH;
+		table[h] = i;
+		if (c >= i || i - c > LZ_MAX_OFFSET || lz_read32(s + c) != v) {
+			i++;
+			continue;
+		}
+		while (i + m < n && s[c + m] == s[i + m])
+			m++;
+		r = lz_sequence(d + o, dn - o, s + anchor, i - anchor, i - c, m);
+		if (r == LZ_ERROR)
+			return LZ_ERROR;
+		o += r;
+		i += m;
+		anchor = i;
+	}
+	r = lz_sequence(d + o, dn - o, s + anchor, n - anchor, 0, 0);
+	return r == LZ_ERROR ? LZ_ERROR : o + r;
+}
+
+static size_t lz_decompress(const uint8_t *s, size_t n, uint8_t *d, size_t dn)
+{
+	size_t i = 0, o = 0;
+	while (i < n) {
+		unsigned token = s[i++], b = 255;
+		size_t count = token >> 4, match = token & 15, offset;
+		if (count == 15)
+			for (b = 255; b == 255; count += b)
+				if (i == n || (b = s[i++], count + b < count))
+					return LZ_ERROR;
+		if (count > n - i || count > dn - o)
+			return LZ_ERROR;
+		memcpy(d + o, s + i, count);
+		i += count;
+		o += count;
+		if (i == n)
+			break;
+		if (n - i < 2)
+			return LZ_ERROR;
+		offset = s[i] | (s[i + 1] << 8);
+		i += 2;
+		if (match == 15)
+			for (b = 255; b == 255; match += b)
+				if (i == n || (b = s[i++], match + b < match))
+					return LZ_ERROR;
+		match += LZ_MIN_MATCH;
+		if (!offset || offset > o || match > dn - o)
+			return LZ_ERROR;
+		for (; match; match--, o++) /* may overlap, copy bytewise */
+			d[o] = d[o - offset];
+	}
+	return o;
+}
+
+/**
+**core_range** checks that a range of characters given to one of the
+compression or conversion instructions lies within the core.
+**/
+static bool core_range(forth_t *o, forth_cell_t addr, forth_cell_t length)
+{
+	forth_cell_t size = o->core_size * sizeof(forth_cell_t);
+	return addr <= size && length <= size - addr;
+}
+
+/**
+The file variants compress a file in blocks of **LZ_BLOCK** bytes, each
+block is written out as its uncompressed and compressed size, as four
+byte little endian numbers, followed by the compressed data. If the data
+did not compress its two sizes are the same and it is stored as it is. A
+block with an uncompressed size of zero ends the file. They return zero on
+success or an error number, which is **EILSEQ** if the compressed data
+is not valid.
+**/
+#define LZ_BLOCK (1ul << 16)
+
+static void lz_put32(uint8_t *d, size_t n)
+{
+	for (int i = 0; i < 4; i++, n >>= 8)
+		d[i] = n & 0xff;
+}
+
+static size_t lz_get32(const uint8_t *s)
+{
+	return s[0] | (s[1] << 8) | ((size_t)s[2] << 16) | ((size_t)s[3] << 24);
+}
+
+static int lz_compress_file(FILE *in, FILE *out)
+{
+	const size_t bound = LZ_BLOCK + LZ_BLOCK / 255 + 16;
+	uint8_t *raw = malloc(LZ_BLOCK), *packed = malloc(bound + 8);
+	size_t n = 0, r;
+	int rval = 0;
+	errno = 0;
+	if (!raw || !packed)
+		goto end;
+	do {
+		n = fread(raw, 1, LZ_BLOCK, in);
+		if (ferror(in))
+			goto end;
+		r = lz_compress(raw, n, packed + 8, bound);
+		if (r == LZ_ERROR || r >= n) {
+			memcpy(packed + 8, raw, n);
+			r = n;
+		}
+		lz_put32(packed, n);
+		lz_put32(packed + 4, r);
+		if (fwrite(packed, 1, r + 8, out) != r + 8)
+			goto end;
+	} while (n);
+end:
+	rval = errno ? ferrno() : (ferror(in) || ferror(out)) ? -1 : 0;
+	free(raw);
+	free(packed);
+	return rval;
+}
+
+static int lz_decompress_file(FILE *in, FILE *out)
+{
+	uint8_t *raw = malloc(LZ_BLOCK), *packed = malloc(LZ_BLOCK);
+	uint8_t sizes[8];
+	size_t n, r;
+	int rval = 0;
+	errno = 0;
+	if (!raw || !packed)
+		goto end;
+	for (;;) {
+		if (fread(sizes, 1, 8, in) != 8)
+			goto invalid;
+		n = lz_get32(sizes);
+		r = lz_get32(sizes + 4);
+		if (!n)
+			break;
+		if (n > LZ_BLOCK || r > n || fread(packed, 1, r, in) != r)
+			goto invalid;
+		if (r < n && lz_decompress(packed, r, raw, n) != n)
+			goto invalid;
+		if (fwrite(r < n ? raw : packed, 1, n, out) != n)
+			goto end;
+	}
+	goto end;
+invalid:
+	if (!ferror(in))
+		errno = EILSEQ;
+end:
+	rval = errno ? ferrno() : (ferror(in) || ferror(out)) ? -1 : 0;
+	free(raw);
+	free(packed);
+	return rval;
+}
+
+/**
+## Hex and Base64
+
+These functions convert binary data to and from text for the instructions
+**>hex**, **hex>**, **>base64** and **base64>**. Each one returns the
+number of characters written or **CODEC_ERROR** if the output would not fit
+or the input is not valid. Encoding produces lower case hexadecimal and
+standard, padded, Base64, decoding accepts either case of hexadecimal digit
+and Base64 with or without padding. They are table driven and work on
+whole groups of characters at a time, which is as far as we can go without
+resorting to non-portable vector instructions; the compiler is free to do
+better.
+**/
+#define CODEC_ERROR ((size_t)-1)
+
+static const char hex_digits[] = "0123456789abcdef";
+static const char base64_digits[] = 
+	"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static size_t hex_encode(const uint8_t *s, size_t n, uint8_t *d, size_t dn)
+{
+	if (n > dn / 2)
+		return CODEC_ERROR;
+	for (size_t i = 0; i < n; i++) {
+		d[2 * i]     = hex_digits[s[i] >> 4];
+		d[2 * i + 1] = hex_digits[s[i] & 15];
+	}
+	return 2 * n;
+}
+
+static int hex_value(uint8_t c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	c |= 0x20; /* lower case */
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	return -1;
+}
+
+static size_t hex_decode(const uint8_t *s, size_t n, uint8_t *d, size_t dn)
+{
+	if ((n & 1) || n / 2 > dn)
+		return CODEC_ERROR;
+	for (size_t i = 0; i < n; i += 2) {
+		int hi = hex_value(s[i]), lo = hex_value(s[i + 1]);
+		if (hi < 0 || lo < 0)
+			return CODEC_ERROR;
+		d[i / 2] = (hi << 4) | lo;
+	}
+	return n / 2;
+}
+
+static size_t base64_encode(const uint8_t *s, size_t n, uint8_t *d, size_t dn)
+{
+	size_t i = 0, o = 0;
+	if (n / 3 + !!(n % 3) > dn / 4)
+		return CODEC_ERROR;
+	for (; n - i >= 3; i += 3, o += 4) {
+		uint32_t v = ((uint32_t)s[i] << 16) | (s[i + 1] << 8) | s[i + 2];
+		d[o]     = base64_digits[v >> 18];
+		d[o + 1] = base64_digits[(v >> 12) & 63];
+		d[o + 2] = base64_digits[(v >> 6) & 63];
+		d[o + 3] = base64_digits[v & 63];
+	}
+	if (i < n) {
+		uint32_t v = ((uint32_t)s[i] << 16) | (n - i > 1 ? s[i + 1] << 8 : 0);
+		d[o]     = base64_digits[v >> 18];
+		d[o + 1] = base64_digits[(v >> 12) & 63];
+		d[o + 2] = n - i > 1 ? base64_digits[(v >> 6) & 63] : '=';
+		d[o + 3] = '=';
+		o += 4;
+	}
+	return o;
+}
+
+static size_t base64_decode(const uint8_t *s, size_t n, uint8_t *d, size_t dn)
+{
+	uint8_t table[256];
+	uint32_t v = 0;
+	size_t i, o = 0, bits = 0;
+	memset(table, 64, sizeof(table));
+	for (i = 0; i < 64; i++)
+		table[(uint8_t)base64_digits[i]] = i;
+	if (n % 4 == 0 && n && s[n - 1] == '=') /* strip padding */
+		n -= 1 + (s[n - 2] == '=');
+	if (n % 4 == 1)
+		return CODEC_ERROR;
+	if ((n / 4) * 3 + (n % 4 ? n % 4 - 1 : 0) > dn)
+		return CODEC_ERROR;
+	for (i = 0; i < n; i++) {
+		if (table[s[i]] == 64)
+			return CODEC_ERROR;
+		v = (v << 6) | table[s[i]];
+		if ((bits += 6) >= 8) {
+			bits -= 8;
+			d[o++] = v >> bits;
+		}
+	}
+	return o;
+}
+
+/**
+## Delimited Fields
+
+**split_fields** splits a record of delimited text, such as a line of a CSV
+or TSV file, into fields for **split-fields**. The offset from the start of
+the record and the length of each field are stored as pairs in **fields**,
+up to **max** of them, the number of fields in the record is returned even
+if they did not all fit so that a caller can tell the array was too small.
+
+A field that starts with a double quote is quoted, as in RFC 4180, and
+delimiters and new lines inside it are part of the field. The quotes are
+removed and doubled quotes inside it are replaced by a single one, which
+is done in place, so the field is shortened and the record modified.
+Anything between the closing quote and the next delimiter is thrown away.
+
+The searching is done with *memchr*, which is about as fast as you can
+scan for a single character portably, C libraries usually use vector
+instructions for it, and so each field takes a handful of calls instead of
+a loop over every character.
+**/
+static size_t split_fields(char *s, size_t length, char delim, 
+		forth_cell_t *fields, size_t max)
+{
+	size_t n = 0, i = 0;
+	for (;;) {
+		size_t start = i, end = i;
+		const char *d;
+		if (i < length && s[i] == '"') {
+			start = end = ++i;
+			while (i < length) {
+				const char *q = memchr(s + i, '"', length - i);
+				size_t stop = q ? (size_t)(q - s) : length;
+				memmove(s + end, s + i, stop - i);
+				end += stop - i;
+				i = stop;
+				if (i >= length)
+					break;
+				if (i + 1 < length && s[i + 1] == '"') {
+					s[end++] = '"';
+					i += 2;
+					continue;
+				}
+				i++;
+				break;
+			}
+			d = memchr(s + i, delim, length - i);
+			i = d ? (size_t)(d - s) : length;
+		} else {
+			d = memchr(s + i, delim, length - i);
+			end = i = d ? (size_t)(d - s) : length;
+		}
+		if (n < max) {
+			fields[2 * n]     = start;
+			fields[2 * n + 1] = end - start;
+		}
+		n++;
+		if (i >= length)
+			return n;
+		i++;
+	}
+}
+
+/**
+**read_record** reads a record for **read-record**, a line of text that
+does not end if a new line is inside double quotes, so a quoted CSV field
+can contain them. The new line is not stored, nor is a carriage return
+before it. If the buffer fills up before the end of the record the rest of
+it is left to be read next time, and **eof** is set if the end of the file
+was reached before anything was read. It uses the buffering that *stdio*
+already does for us, character by character reading from a FILE is cheap
+in C, unlike reading each character with **read-file**.
+**/
+static size_t read_record(FILE *file, char *buf, size_t size, bool *eof)
+{
+	size_t n = 0;
+	bool quoted = false;
+	int ch = EOF;
+	while (n < size && (ch = getc(file)) != EOF) {
+		if (ch == '"')
+			quoted = !quoted;
+		else if (ch == '\n' && !quoted)
+			break;
+		buf[n++] = ch;
+	}
+	if (ch == '\n' && n && buf[n - 1] == '\r')
+		n--;
+	*eof = ch == EOF && !n;
+	return n;
+}
+
+/**
+## Formatted Output
+
+**format** and **format>buf** print a list of arguments taken from the
+stack as described by a format string, in the manner of C's *printf*, but
+with far fewer options. A directive starts with a '%', followed by any
+number of the flags '-', to left justify the field, and '0', to pad a number
+with zeros, then an optional field width, and a conversion character:
+
+	d   a signed number in the current base
+	u   an unsigned number in the current base
+	x   an unsigned number in hexadecimal
+	o   an unsigned number in octal
+	b   an unsigned number in binary
+	c   a character
+	s   a string, which takes two arguments, c-addr u
+	%   a literal '%', which takes no arguments
+
+The first directive takes the deepest argument, so that the arguments are
+pushed in the order they are printed. The output goes either to a file or
+to a buffer, a **format_sink** holds whichever one it is and the total
+length written.
+**/
+struct format_sink {
+	FILE *file;
+	char *buf;
+	size_t size, length;
+};
+
+struct format_spec {
+	bool left, zero;
+	size_t width;
+	int conversion;
+};
+
+#define FORMAT_MAX_WIDTH (1024u)
+
+static void format_put(struct format_sink *d, const char *s, size_t n)
+{
+	if (d->file)
+		fwrite(s, 1, n, d->file);
+	else if (d->length <= d->size && n <= d->size - d->length)
+		memcpy(d->buf + d->length, s, n);
+	d->length += n;
+}
+
+static void format_pad(struct format_sink *d, char ch, size_t n)
+{
+	char pad[32];
+	memset(pad, ch, sizeof(pad));
+	for (; n > sizeof(pad); n -= sizeof(pad))
+		format_put(d, pad, sizeof(pad));
+	format_put(d, pad, n);
+}
+
+/**
+**format_parse** parses a directive following a '%', returning the number
+of characters it took up.
+**/
+static size_t format_parse(const char *s, size_t n, struct format_spec *spec)
+{
+	size_t i = 0;
+	memset(spec, 0, sizeof(*spec));
+	for (; i < n && (s[i] == '-' || s[i] == '0'); i++)
+		*(s[i] == '-' ? &spec->left : &spec->zero) = true;
+	for (; i < n && isdigit((unsigned char)s[i]); i++)
+		if (spec->width < FORMAT_MAX_WIDTH)
+			spec->width = spec->width * 10 + (s[i] - '0');
+	spec->conversion = i < n ? s[i++] : 0;
+	return i;
+}
+
+/**
+**format_arguments** checks a format string and returns the number of
+cells of arguments it needs, or -1 if it contains an invalid directive.
+**/
+static long format_arguments(const char *s, size_t n)
+{
+	long cells = 0;
+	struct format_spec spec;
+	for (size_t i = 0; i < n; ) {
+		const char *pct = memchr(s + i, '%', n - i);
+		if (!pct)
+			break;
+		i = (pct - s) + 1;
+		i += format_parse(s + i, n - i, &spec);
+		if (!spec.conversion || !strchr("duxobcs%", spec.conversion))
+			return -1;
+		cells += spec.conversion == 's' ? 2 : spec.conversion != '%';
+	}
+	return cells;
+}
+
+/**
+**format_render** writes out the format string and arguments, which have
+been checked by **format_arguments**, returning -1 if the current base is
+invalid or a string is not within the core.
+**/
+static int format_render(forth_t *o, struct format_sink *d, 
+		const char *s, size_t n, const forth_cell_t *args)
+{
+	struct format_spec spec;
+	unsigned base = o->m[BASE] ? o->m[BASE] : 10;
+	for (size_t i = 0; i < n; ) {
+		char number[sizeof(forth_cell_t) * CHAR_BIT];
+		const char *field = number + sizeof(number);
+		const char *pct = memchr(s + i, '%', n - i);
+		size_t stop = pct ? (size_t)(pct - s) : n, length = 0;
+		bool negative = false;
+		forth_cell_t u;
+		unsigned radix = base;
+		format_put(d, s + i, stop - i);
+		if (!pct)
+			break;
+		i = stop + 1;
+		i += format_parse(s + i, n - i, &spec);
+		switch (spec.conversion) {
+		case '%': 
+			field = "%"; 
+			length = 1; 
+			break;
+		case 'c': 
+			number[0] = *args++; 
+			field = number; 
+			length = 1; 
+			break;
+		case 's': 
+			u = *args++;
+			length = *args++;
+			if (!core_range(o, u, length))
+				return -1;
+			field = (char*)o->m + u;
+			break;
+		case 'd':
+		case 'u':
+		case 'x':
+		case 'o':
+		case 'b':
+			u = *args++;
+			radix = spec.conversion == 'x' ? 16 : 
+				spec.conversion == 'o' ? 8 : 
+				spec.conversion == 'b' ? 2 : base;
+			if (radix < 2 || radix > 36)
+				return -1;
+			if (spec.conversion == 'd' && (intptr_t)u < 0) {
+				negative = true;
+				u = -u;
+			}
+			do {
+				*(char*)--field = conv[u % radix];
+				length++;
+			} while ((u /= radix));
+			break;
+		}
+		if (spec.width > length + negative && !spec.left && !spec.zero)
+			format_pad(d, ' ', spec.width - length - negative);
+		if (negative)
+			format_put(d, "-", 1);
+		if (spec.width > length + negative && !spec.left && spec.zero)
+			format_pad(d, '0', spec.width - length - negative);
+		format_put(d, field, length);
+		if (spec.width > length + negative && spec.left)
+			format_pad(d, ' ', spec.width - length - negative);
+	}
+	return 0;
+}
+
+/**
+## Arbitrary Precision Integers
+
+The **(big)** instruction implements a word set for integers of any size,
+"bignums", which are kept outside of the core in memory from *malloc*, in
+the same way as memory from **allocate** is, and a bignum is referred to by
+its address. Each operation returns a new bignum, which should be freed
+with **big-free** when it is no longer needed. A bignum is a sign and a
+magnitude stored as an array of 32-bit limbs, least significant first,
+without leading zeros, so zero has no limbs at all. 32-bit limbs are used
+so that the product of two of them fits in a *uint64_t*, which C99 gives
+us, and the code stays portable.
+
+The words are defined in "forth.fth" in terms of **(big)**, which takes an
+operation number on the top of the stack, to save on instructions. Division
+rounds towards zero and the remainder has the sign of the dividend, as
+with the division of cells. Numbers are converted to and from strings in the
+current base.
+
+The functions starting with **mag_** work on magnitudes, arrays of limbs,
+and the ones starting with **big_** on whole bignums.
+**/
+#define BIG_LIMB_BITS  (32)
+#define BIG_KARATSUBA  (32) /* limbs, below this schoolbook is faster */
+
+struct big {
+	size_t length;  /**< number of limbs in use */
+	bool negative;  /**< sign, zero is never negative */
+	uint32_t limb[];
+};
+
+enum big_operation {
+	BIG_ADD, BIG_SUB, BIG_MUL, BIG_DIVMOD, BIG_GCD, BIG_COMPARE,
+	BIG_FROM_CELL, BIG_TO_CELL, BIG_FROM_STRING, BIG_TO_STRING,
+	BIG_PRINT, BIG_FREE, BIG_LAST_OPERATION
+};
+
+static size_t mag_normalize(const uint32_t *a, size_t n)
+{
+	while (n && !a[n - 1])
+		n--;
+	return n;
+}
+
+static int mag_compare(const uint32_t *a, size_t an, const uint32_t *b, 
+		size_t bn)
+{
+	if (an != bn)
+		return an < bn ? -1 : 1;
+	while (an--)
+		if (a[an] != b[an])
+			return a[an] < b[an] ? -1 : 1;
+	return 0;
+}
+
+/* r = a + b, where an >= bn, r has an limbs and may be a, returns carry */
+static uint32_t mag_add(uint32_t *r, const uint32_t *a, size_t an, 
+		const uint32_t *b, size_t bn)
+{
+	uint64_t carry = 0;
+	size_t i;
+	for (i = 0; i < bn; i++) {
+		carry += (uint64_t)a[i] + b[i];
+		r[i] = carry;
+		carry >>= BIG_LIMB_BITS;
+	}
+	for (; i < an; i++) {
+		carry += a[i];
+		r[i] = carry;
+		carry >>= BIG_LIMB_BITS;
+	}
+	return carry;
+}
+
+/* r = a - b, where an >= bn, r has an limbs and may be a, returns borrow */
+static uint32_t mag_sub(uint32_t *r, const uint32_t *a, size_t an, 
+		const uint32_t *b, size_t bn)
+{
+	uint64_t borrow = 0;
+	size_t i;
+	for (i = 0; i < an; i++) {
+		uint64_t d = (uint64_t)a[i] - (i < bn ? b[i] : 0) - borrow;
+		r[i] = d;
+		borrow = d >> 63;
+	}
+	return borrow;
+}
+
+static void mag_mul_basic(uint32_t *r, const uint32_t *a, size_t an, 
+		const uint32_t *b, size_t bn)
+{
+	memset(r, 0, (an + bn) * sizeof(*r));
+	for (size_t i = 0; i < bn; i++) {
+		uint64_t carry = 0;
+		for (size_t j = 0; j < an; j++) {
+			carry += (uint64_t)a[j] * b[i] + r[i + j];
+			r[i + j] = carry;
+			carry >>= BIG_LIMB_BITS;
+		}
+		r[i + an] = carry;
+	}
+}
+
+/**
+**mag_mul** multiplies **a** by **b** into **r**, which has room for
+**an + bn** limbs, using Karatsuba multiplication once both numbers are
+larger than **BIG_KARATSUBA** limbs. The numbers are split in two at **m**
+limbs, so that:
+
+	a * b = z2 * B^2m + z1 * B^m + z0
+
+Where:
+
+	z0 = a0 * b0
+	z2 = a1 * b1
+	z1 = (a0 + a1) * (b0 + b1) - z0 - z2
+
+Which takes three multiplications instead of four. If one number is less
+than half the length of the other the long one is split instead, and if
+there is not enough memory for the temporary values it falls back to the
+schoolbook method, which is slower but needs none. See
+<https://en.wikipedia.org/wiki/Karatsuba_algorithm>.
+**/
+static void mag_mul(uint32_t *r, const uint32_t *a, size_t an, 
+		const uint32_t *b, size_t bn)
+{
+	size_t m, san, sbn, tn;
+	uint32_t *sa, *sb, *t;
+	if (an < bn) {
+		const uint32_t *swap = a;
+		a = b, b = swap;
+		m = an, an = bn, bn = m;
+	}
+	if (bn < BIG_KARATSUBA) {
+		mag_mul_basic(r, a, an, b, bn);
+		return;
+	}
+	m = an / 2;
+	if (bn <= m) {
+		if (!(t = malloc((an - m + bn) * sizeof(*t)))) {
+			mag_mul_basic(r, a, an, b, bn);
+			return;
+		}
+		mag_mul(r, a, m, b, bn);
+		memset(r + m + bn, 0, (an - m) * sizeof(*r));
+		mag_mul(t, a + m, an - m, b, bn);
+		mag_add(r + m, r + m, an - m + bn, t, an - m + bn);
+		free(t);
+		return;
+	}
+	san = an - m + 1;
+	sbn = (bn - m > m ? bn - m : m) + 1;
+	tn  = san + sbn;
+	if (!(sa = malloc((san + sbn + tn) * sizeof(*sa)))) {
+		mag_mul_basic(r, a, an, b, bn);
+		return;
+	}
+	sb = sa + san;
+	t  = sb + sbn;
+	sa[san - 1] = mag_add(sa, a + m, an - m, a, m);
+	if (bn - m >= m)
+		sb[sbn - 1] = mag_add(sb, b + m, bn - m, b, m);
+	else
+		sb[sbn - 1] = mag_add(sb, b, m, b + m, bn - m);
+	mag_mul(r, a, m, b, m);
+	mag_mul(r + 2 * m, a + m, an - m, b + m, bn - m);
+	mag_mul(t, sa, san, sb, sbn);
+	mag_sub(t, t, tn, r, 2 * m);
+	mag_sub(t, t, tn, r + 2 * m, an + bn - 2 * m);
+	mag_add(r + m, r + m, an + bn - m, t, mag_normalize(t, tn));
+	free(sa);
+}
+
+/* q = a / d, returning the remainder, q has an limbs and may be a */
+static uint32_t mag_divmod_limb(uint32_t *q, const uint32_t *a, size_t an, 
+		uint32_t d)
+{
+	uint64_t rem = 0;
+	while (an--) {
+		rem = (rem << BIG_LIMB_BITS) | a[an];
+		q[an] = rem / d;
+		rem %= d;
+	}
+	return rem;
+}
+
+/**
+**mag_divmod** divides **a** by **b**, putting **an - bn + 1** limbs of
+quotient into **q** and **bn** limbs of remainder into **r**, with the
+algorithm from Knuth's "The Art of Computer Programming", volume 2, section
+4.3.1, algorithm D. It returns -1 if it runs out of memory. **b** must not
+have any leading zeros and must not be longer than **a**.
+**/
+static int mag_divmod(uint32_t *q, uint32_t *r, const uint32_t *a, 
+		size_t an, const uint32_t *b, size_t bn)
+{
+	uint32_t *u, *v;
+	unsigned s = 0;
+	size_t i, j;
+	if (bn == 1) {
+		r[0] = mag_divmod_limb(q, a, an, b[0]);
+		return 0;
+	}
+	if (!(u = malloc((an + 1 + bn) * sizeof(*u))))
+		return -1;
+	v = u + an + 1;
+	while (!(b[bn - 1] << s & 0x80000000u))
+		s++;
+	for (i = bn - 1; i > 0; i--)
+		v[i] = b[i] << s | (s ? b[i - 1] >> (BIG_LIMB_BITS - s) : 0);
+	v[0] = b[0] << s;
+	u[an] = s ? a[an - 1] >> (BIG_LIMB_BITS - s) : 0;
+	for (i = an - 1; i > 0; i--)
+		u[i] = a[i] << s | (s ? a[i - 1] >> (BIG_LIMB_BITS - s) : 0);
+	u[0] = a[0] << s;
+	for (j = an - bn + 1; j--; ) {
+		uint64_t n = (uint64_t)u[j + bn] << BIG_LIMB_BITS | u[j + bn - 1];
+		uint64_t qhat = n / v[bn - 1], rhat = n % v[bn - 1];
+		uint64_t carry = 0, borrow = 0, d;
+		while (qhat >> BIG_LIMB_BITS || qhat * v[bn - 2] > 
+				(rhat << BIG_LIMB_BITS | u[j + bn - 2])) {
+			qhat--;
+			if ((rhat += v[bn - 1]) >> BIG_LIMB_BITS)
+				break;
+		}
+		for (i = 0; i < bn; i++) {
+			uint64_t p = qhat * v[i] + carry;
+			carry = p >> BIG_LIMB_BITS;
+			d = (uint64_t)u[i + j] - (uint32_t)p - borrow;
+			u[i + j] = d;
+			borrow = d >> 63;
+		}
+		d = (uint64_t)u[j + bn] - carry - borrow;
+		u[j + bn] = d;
+		q[j] = qhat;
+		if (d >> 63) { /* subtracted too much, add one back */
+			q[j]--;
+			u[j + bn] += mag_add(u + j, u + j, bn, v, bn);
+		}
+	}
+	for (i = 0; i < bn - 1; i++)
+		r[i] = u[i] >> s | (s ? u[i + 1] << (BIG_LIMB_BITS - s) : 0);
+	r[bn - 1] = u[bn - 1] >> s;
+	free(u);
+	return 0;
+}
+
+static struct big *big_new(size_t length)
+{
+	struct big *b = calloc(1, sizeof(*b) + length * sizeof(b->limb[0]));
+	if (b)
+		b->length = length;
+	return b;
+}
+
+static struct big *big_normalize(struct big *b)
+{
+	if (b) {
+		b->length = mag_normalize(b->limb, b->length);
+		if (!b->length)
+			b->negative = false;
+	}
+	return b;
+}
+
+/**
+A cell might be only 32 bits, the same as a limb, so it is shifted by a
+limb in two halves to avoid shifting by its whole width, which is undefined.
+**/
+static struct big *big_from_cell(forth_cell_t c)
+{
+	struct big *b = big_new((sizeof(c) * CHAR_BIT) / BIG_LIMB_BITS);
+	if (!b)
+		return NULL;
+	if ((b->negative = (intptr_t)c < 0))
+		c = -c;
+	for (size_t i = 0; i < b->length; i++, c >>= BIG_LIMB_BITS / 2, 
+			c >>= BIG_LIMB_BITS / 2)
+		b->limb[i] = c;
+	return big_normalize(b);
+}
+
+static forth_cell_t big_to_cell(const struct big *b)
+{
+	forth_cell_t c = 0;
+	for (size_t i = b->length; i--; )
+		c = (c << BIG_LIMB_BITS / 2 << BIG_LIMB_BITS / 2) | b->limb[i];
+	return b->negative ? -c : c;
+}
+
+/* a + b, or a - b if subtract is true */
+static struct big *big_add(const struct big *a, const struct big *b, 
+		bool subtract)
+{
+	bool bneg = b->negative != subtract;
+	struct big *r;
+	if (a->negative == bneg) {
+		if (a->length < b->length) {
+			const struct big *swap = a;
+			a = b, b = swap;
+		}
+		if (!(r = big_new(a->length + 1)))
+			return NULL;
+		r->limb[a->length] = mag_add(r->limb, a->limb, a->length, 
+				b->limb, b->length);
+		r->negative = bneg;
+		return big_normalize(r);
+	}
+	if (mag_compare(a->limb, a->length, b->limb, b->length) < 0) {
+		const struct big *swap = a;
+		a = b, b = swap;
+		bneg = !bneg;
+	}
+	if (!(r = big_new(a->length)))
+		return NULL;
+	mag_sub(r->limb, a->limb, a->length, b->limb, b->length);
+	r->negative = !bneg;
+	return big_normalize(r);
+}
+
+static struct big *big_mul(const struct big *a, const struct big *b)
 {
-	assert(o);
-	assert(o->S > o->m);
-	forth_cell_t f = o->m[TOP];
-	o->m[TOP] = *(o->S)--;
-	return f;
+	struct big *r = big_new(a->length + b->length);
+	if (!r)
+		return NULL;
+	if (a->length && b->length)
+		mag_mul(r->limb, a->limb, a->length, b->limb, b->length);
+	r->negative = a->negative != b->negative;
+	return big_normalize(r);
 }
 
-forth_cell_t forth_stack_position(forth_t *o)
+/* q = a / b, r = a mod b, b must not be zero, returns -1 on failure */
+static int big_divmod(const struct big *a, const struct big *b, 
+		struct big **q, struct big **r)
 {
-	assert(o);
-	return o->S - o->vstart;
+	*q = big_new(a->length >= b->length ? a->length - b->length + 1 : 0);
+	*r = big_new(b->length);
+	if (!*q || !*r)
+		goto fail;
+	if (a->length < b->length)
+		memcpy((*r)->limb, a->limb, a->length * sizeof(a->limb[0]));
+	else if (mag_divmod((*q)->limb, (*r)->limb, a->limb, a->length, 
+				b->limb, b->length) < 0)
+		goto fail;
+	(*q)->negative = a->negative != b->negative;
+	(*r)->negative = a->negative;
+	big_normalize(*q);
+	big_normalize(*r);
+	return 0;
+fail:
+	free(*q);
+	free(*r);
+	*q = *r = NULL;
+	return -1;
 }
 
-void forth_signal(forth_t *o, int sig)
+static struct big *big_copy(const struct big *a)
 {
-	assert(o);
-	o->m[SIGNAL_HANDLER] = (forth_cell_t)((sig * -1) + BIAS_SIGNAL);
+	struct big *r = big_new(a->length);
+	if (r) {
+		memcpy(r->limb, a->limb, a->length * sizeof(a->limb[0]));
+		r->negative = a->negative;
+	}
+	return r;
 }
 
-char *forth_strdup(const char *s)
+static struct big *big_gcd(const struct big *a, const struct big *b)
 {
-	assert(s);
-	char *str;
-	if (!(str = malloc(strlen(s) + 1)))
-		return NULL;
-	strcpy(str, s);
-	return str;
+	struct big *x = big_copy(a), *y = NULL;
+	struct big *q, *r;
+	if (!x || !(y = big_copy(b)))
+		goto fail;
+	while (y->length) {
+		if (big_divmod(x, y, &q, &r) < 0)
+			goto fail;
+		free(q);
+		free(x);
+		x = y;
+		y = r;
+	}
+	free(y);
+	x->negative = false;
+	return x;
+fail:
+	free(x);
+	free(y);
+	return NULL;
 }
 
-void forth_free_words(char **s, size_t length)
+/**
+Conversion to and from strings is done a limb sized chunk at a time, the
+largest power of the base that fits in a limb is worked out by
+**big_chunk**, so that most of the work is multiplying or dividing by
+a single limb.
+**/
+static unsigned big_chunk(unsigned base, uint32_t *power)
 {
-	for (size_t i = 0; i < length; i++)
-		free(s[i]);
-	free(s);
+	unsigned digits = 0;
+	for (*power = 1; *power <= UINT32_MAX / base; digits++)
+		*power *= base;
+	return digits;
 }
 
-char **forth_words(forth_t *o, size_t *length)
+/* returns NULL with invalid set to true if the string is not a number */
+static struct big *big_from_string(const char *s, size_t n, unsigned base, 
+		bool *invalid)
 {
-	assert(o);
-	assert(length);
-	forth_cell_t pwd = o->m[PWD];
-	forth_cell_t *m  = o->m;
-	size_t i;
-	char **n, **s = calloc(2, sizeof(*s));
-	if (!s)
+	uint32_t power, chunk = 0, scale = 1;
+	bool negative = n && *s == '-';
+	size_t i = negative, length = 0;
+	struct big *b;
+	*invalid = i >= n || base < 2 || base > 36;
+	if (*invalid || !(b = big_new(n / 2 + 2)))
 		return NULL;
-	for (i = 0 ;pwd > DICTIONARY_START; pwd = m[pwd], i++) {
-		forth_cell_t len = WORD_LENGTH(m[pwd + 1]);
-		s[i] = forth_strdup((char*)(&m[pwd-len]));
-		if (!s[i]) {
-			forth_free_words(s, i);
-			*length = 0;
+	big_chunk(base, &power);
+	for (; i <= n; i++) {
+		const char *digit = i < n ? 
+			strchr(conv, tolower((unsigned char)s[i])) : NULL;
+		if (i < n && (!s[i] || !digit || (unsigned)(digit - conv) >= base)) {
+			free(b);
+			*invalid = true;
 			return NULL;
 		}
-		n = realloc(s, sizeof(*s) * (i+2));
-		if (!n) {
-			forth_free_words(s, i);
-			*length = 0;
-			return NULL;
+		if (i < n && scale < power) {
+			chunk = chunk * base + (digit - conv);
+			scale *= base;
+			continue;
+		}
+		uint64_t carry = chunk;
+		for (size_t j = 0; j < length; j++) {
+			carry += (uint64_t)b->limb[j] * scale;
+			b->limb[j] = carry;
+			carry >>= BIG_LIMB_BITS;
+		}
+		if (carry)
+			b->limb[length++] = carry;
+		if (i < n) {
+			chunk = digit - conv;
+			scale = base;
 		}
-		s = n;
 	}
-	*length = i;
-	return s;
+	b->length = length;
+	b->negative = negative;
+	return big_normalize(b);
+}
+
+/* writes the number in reverse into 'd', returns its length or 0 on error */
+static size_t big_to_string(const struct big *b, unsigned base, 
+		char *d, size_t size)
+{
+	uint32_t power, *q;
+	unsigned digits;
+	size_t n = 0, length = b->length;
+	if (base < 2 || base > 36 || !size)
+		return 0;
+	digits = big_chunk(base, &power);
+	if (!(q = malloc((length + 1) * sizeof(*q))))
+		return 0;
+	memcpy(q, b->limb, length * sizeof(*q));
+	do {
+		uint32_t chunk = mag_divmod_limb(q, q, length, power);
+		length = mag_normalize(q, length);
+		for (unsigned i = 0; i < digits && (chunk || length); i++) {
+			if (n >= size)
+				goto fail;
+			d[n++] = conv[chunk % base];
+			chunk /= base;
+		}
+	} while (length);
+	if (!n)
+		d[n++] = '0';
+	if (b->negative && n < size)
+		d[n++] = '-';
+	else if (b->negative)
+		goto fail;
+	free(q);
+	return n;
+fail:
+	free(q);
+	return 0;
+}
+
+/**
+**big_operation** performs one of the operations for **(big)**, with the
+top of the stack in **f** and the rest of it in **S**, whose depth has been
+checked. It returns -1 if there is an error, after printing a message.
+**/
+static int big_operation(forth_t *o, forth_cell_t op, forth_cell_t **sp, 
+		forth_cell_t *fp)
+{
+	forth_cell_t *S = *sp, f = *fp, length;
+	struct big *a = NULL, *b = NULL, *r = NULL, *q = NULL;
+	unsigned base = o->m[BASE] ? o->m[BASE] : 10;
+	bool invalid = false;
+	char *s;
+	switch (op) {
+	case BIG_ADD: case BIG_SUB: case BIG_MUL: case BIG_DIVMOD:
+	case BIG_GCD: case BIG_COMPARE: 
+		a = (struct big*)*S--;
+		/* fall through */
+	case BIG_TO_CELL: case BIG_TO_STRING: case BIG_PRINT: 
+		b = (struct big*)(op == BIG_TO_STRING ? S[-1] : f);
+		if (!b || (op <= BIG_COMPARE && !a))
+			return error("invalid bignum %p", (void*)(a ? b : a)), -1;
+	}
+	switch (op) {
+	case BIG_ADD:     r = big_add(a, b, false); break;
+	case BIG_SUB:     r = big_add(a, b, true);  break;
+	case BIG_MUL:     r = big_mul(a, b);        break;
+	case BIG_GCD:     r = big_gcd(a, b);        break;
+	case BIG_COMPARE:
+		f = a->negative != b->negative ? (b->negative ? 1 : -1) :
+			mag_compare(a->limb, a->length, b->limb, b->length) * 
+			(a->negative ? -1 : 1);
+		break;
+	case BIG_DIVMOD:
+		if (!b->length)
+			return error("divide bignum by zero %s", ""), -1;
+		if (big_divmod(a, b, &q, &r) < 0)
+			break;
+		*++S = (forth_cell_t)r;
+		r = q;
+		break;
+	case BIG_FROM_CELL:
+		r = big_from_cell(f);
+		break;
+	case BIG_TO_CELL:
+		f = big_to_cell(b);
+		break;
+	case BIG_FROM_STRING:
+		length = f;
+		f = *S--;
+		if (!core_range(o, f, length))
+			return error("invalid string %"PRIdCell, f), -1;
+		r = big_from_string((char*)o->m + f, length, base, &invalid);
+		if (invalid)
+			return error("invalid number '%.*s'", (int)length, 
+					(char*)o->m + f), -1;
+		break;
+	case BIG_TO_STRING:
+		length = f;
+		f = *S--;
+		S--;
+		if (!core_range(o, f, length))
+			return error("invalid string %"PRIdCell, f), -1;
+		s = (char*)o->m + f;
+		length = big_to_string(b, base, s, length);
+		for (size_t i = 0; i < length / 2; i++) {
+			char c = s[i];
+			s[i] = s[length - i - 1];
+			s[length - i - 1] = c;
+		}
+		f = length ? length : (forth_cell_t)-1;
+		break;
+	case BIG_PRINT:
+		length = b->length * BIG_LIMB_BITS + 2;
+		if (!(s = malloc(length)))
+			return error("out of memory printing bignum %p", (void*)b), -1;
+		for (length = big_to_string(b, base, s, length); length--; )
+			fputc(s[length], (FILE*)(o->m[FOUT]));
+		free(s);
+		f = *S--;
+		break;
+	case BIG_FREE:
+		free((struct big*)f);
+		f = *S--;
+		break;
+	default:
+		return error("invalid bignum operation %"PRIdCell, op), -1;
+	}
+	if (op <= BIG_DIVMOD || op == BIG_GCD || op == BIG_FROM_CELL || 
+			op == BIG_FROM_STRING) {
+		if (!r)
+			return error("bignum allocation failed %s", ""), -1;
+		f = (forth_cell_t)r;
+	}
+	*sp = S;
+	*fp = f;
+	return 0;
 }
 
 /**
 ## The Forth Virtual Machine
 **/
 
+/**
+When recording, the stack effect of a function called with **CALL** is
+logged along with its return value, so that when replaying the function
+does not need to be called at all. A function can consume up to its depth
+worth of items, these and anything it pushes are recorded. Any other
+changes the function makes are not captured.
+**/
+static void call_record(forth_t *o, forth_cell_t i, forth_cell_t *before, 
+		forth_cell_t w)
+{
+	forth_cell_t depth = o->calls->functions[i].depth;
+	forth_cell_t *low = (forth_cell_t)(before - o->vstart) > depth ? 
+		before - depth : o->vstart;
+	if (o->S < low)
+		low = o->S;
+	record_event(o, EVENT_CALL, w);
+	put_cell(o->record, low - o->vstart);
+	put_cell(o->record, o->S - low);
+	for (; low <= o->S; low++)
+		put_cell(o->record, *low);
+	put_cell(o->record, o->m[TOP]);
+}
+
+static int call_replay(forth_t *o, forth_cell_t i, forth_cell_t *w)
+{
+	forth_cell_t low, count, j;
+	if (replay_event(o, EVENT_CALL, w) < 0 
+	|| get_cell(o->replay, &low) < 0 
+	|| get_cell(o->replay, &count) < 0)
+		return -1;
+	if (o->vstart + low + count > o->vend) {
+		fatal("replayed call %"PRIdCell" overflows stack", i);
+		return -1;
+	}
+	for (j = 0; j <= count; j++)
+		if (get_cell(o->replay, &o->vstart[low + j]) < 0)
+			return -1;
+	o->S = o->vstart + low + count;
+	return get_cell(o->replay, &o->m[TOP]);
+}
+
+/**
+The return stack pointer (**RSTK**) and the dictionary pointer (**DIC**) are
+modified by some of the most frequently executed instructions, **RUN**,
+**EXIT**, **>r**, **r>** and **,**. Instead of performing a load and a store
+to the register in the core for each of those instructions they are cached
+in the local variables **R** and **h** for the duration of **forth_run**, the
+compiler is then free to keep them in machine registers.
+
+The cached copies must be written back to the core whenever anything other
+than the virtual machine itself might look at them, and reloaded if
+something else might have changed them. This happens when calling out to C
+functions, when the core itself is being accessed by memory operations
+on the register area, before an error is thrown and when **forth_run**
+returns. These two macros perform the synchronization:
+**/
+#define sync_registers() do { m[RSTK] = R; m[DIC] = h; } while (0)
+#define load_registers() do { R = m[RSTK]; h = m[DIC]; } while (0)
+
+/**
+**safepoint** is where timers that are due get run, it is placed after the
+return address has been pushed by **RUN**, so a callback is called as if the
+word being entered called it first. The callback has to be a word defined
+with ':', which **(timer)** checks for, and it is entered here without
+going through **RUN** again so the safe point is not reached recursively.
+**/
+#define safepoint() do {\
+	if (o->timers && !--o->timers->poll &&\
+			(w = timer_due(o->timers, m, R, I))) {\
+		m[ck(++R)] = I;\
+		I = w + 1;\
+	}\
+} while (0)
+
+/**
+**is_register** determines whether a cell address refers to the register
+area of the core, a memory access there needs to synchronize the cached
+registers, as the Forth words **here** and **r** (amongst others) do.
+**/
+#define is_register(ADDR) ((ADDR) < DICTIONARY_START)
+
+/**
+Only the top of the variable stack is normally cached, in the local variable
+**f**, every operation that consumes two values still has to load one from
+memory and every operation that produces a value has to store one. When
+**USE_STACK_CACHE** is defined the virtual machine instead keeps track of
+how many items are cached, which can be zero, one or two, and carries that
+state from one instruction to the next. The second item, when cached, is
+kept in **n**.
+
+The state is held in **k**, which is a multiple of one more than the
+**INSTRUCTION_MASK** so that it can be combined with the instruction to
+select a case in the main switch statement, each state in effect gets its
+own copy of the dispatch table. Only the most frequently executed
+instructions have a copy for each state, any other instruction first
+spills or fills the cache so that only the top of the stack is cached,
+which is the state the rest of the virtual machine expects, and dispatches
+again. A sequence such as "over over +" then only touches memory once.
+
+**cache_depth** is the difference between the stack pointer and where it
+would be if only the top of the stack was cached, which the depth checks
+need to take into account.
+**/
+#ifdef USE_STACK_CACHE
+#define CACHE_NONE (1 * (INSTRUCTION_MASK + 1)) /* nothing cached */
+#define CACHE_ONE  (2 * (INSTRUCTION_MASK + 1)) /* top in f */
+#define CACHE_TWO  (3 * (INSTRUCTION_MASK + 1)) /* top in f, next in n */
+#define cache_flush() do {\
+		if (k == CACHE_NONE)\
+			f = *S--;\
+		else if (k == CACHE_TWO)\
+			*++S = n;\
+		k = CACHE_ONE; } while (0)
+#define cache_depth() (k == CACHE_NONE ? -1 : k == CACHE_TWO ? 1 : 0)
+#else
+#define cache_depth() (0)
+#endif
+
 /**
 The largest function in the file, which implements the forth virtual
 machine, everything else in this file is just fluff and support for this
@@ -2171,8 +4960,15 @@ int forth_run(forth_t *o)
 		     *S = o->S,  /* convenience variable: stack pointer */
 		     I = o->m[INSTRUCTION], /* instruction pointer */
 		     f = o->m[TOP], /* top of stack */
+		     R = o->m[RSTK], /* cached return stack pointer */
+		     h = o->m[DIC],  /* cached dictionary pointer */
 		     w,          /* working pointer */
 		     clk;        /* clock variable */
+#ifdef USE_STACK_CACHE
+	forth_cell_t n = 0,      /* cached second item on the stack */
+		     k = CACHE_ONE, /* stack cache state */
+		     sw;         /* instruction and state to dispatch on */
+#endif
 
 	assert(m);
 	assert(S);
@@ -2281,10 +5077,20 @@ respectively.
 		w = instruction(m[ck(pc++)]);
 		if (w < LAST_INSTRUCTION) {
 			cd(stack_bounds[w]);
+#if defined(USE_STACK_CACHE) && !defined(NDEBUG)
+			if (o->m[DEBUG] >= FORTH_DEBUG_INSTRUCTION)
+				cache_flush();
+#endif
 			TRACE(o, w, S, f);
 		}
 
+#ifdef USE_STACK_CACHE
+		sw = w | k;
+	DISPATCH:
+		switch (sw) { 
+#else
 		switch (w) { 
+#endif
 
 /**
 When explaining words with example Forth code the
@@ -2294,7 +5100,13 @@ instructions enumeration will not be used (such as **ADD** or
 
 		case PUSH:    *++S = f;     f = m[ck(I++)];          break;
 		case CONST:   *++S = f;     f = m[ck(pc)];           break;
-		case RUN:     m[ck(++m[RSTK])] = I; I = pc;          break;
+		case RUN:
+			m[ck(++R)] = I; 
+			I = pc;
+			if (o->profile)
+				o->profile[pc - 1]++;
+			safepoint();
+			break;
 /**
 **DEFINE** backs the Forth word **:**, which is an immediate word, it reads in a
 new word name, creates a header for that word and enters into compile mode,
@@ -2316,7 +5128,9 @@ The CODE field contains the RUN instruction.
 			m[STATE] = 1; /* compile mode */
 			if (forth_get_word(o, o->s, MAXIMUM_WORD_LENGTH) < 0)
 				goto end;
+			sync_registers();
 			compile(o, RUN, (char*)o->s, true, false);
+			load_registers();
 			break;
 /**
 **IMMEDIATE** makes the current word definition execute regardless of whether we
@@ -2366,21 +5180,24 @@ recursively).
 **/
 			if (forth_get_word(o, o->s, MAXIMUM_WORD_LENGTH) < 0)
 				goto end;
+			if (o->locations)
+				record_location(o, h);
 			if ((w = forth_find(o, (char*)o->s)) > 1) {
 				pc = w;
 				if (m[STATE] && (m[ck(pc)] & COMPILING_BIT)) {
-					m[dic(m[DIC]++)] = pc; /* compile word */
+					m[dic(h++)] = pc; /* compile word */
 					break;
 				}
 				goto INNER; /* execute word */
 			} else if (forth_string_to_cell(o->m[BASE], &w, (char*)o->s)) {
 				error("'%s' is not a word (line %zu)", o->s, o->line);
+				sync_registers();
 				longjmp(on_error, RECOVERABLE);
 			}
 
 			if (m[STATE]) { /* must be a number then */
-				m[dic(m[DIC]++)] = 2; /*fake word push at m[2] */
-				m[dic(m[DIC]++)] = w;
+				m[dic(h++)] = 2; /*fake word push at m[2] */
+				m[dic(h++)] = w;
 			} else { /* push word */
 				*++S = f;
 				f = w;
@@ -2396,10 +5213,34 @@ However, the reason for these words existing, and under what circumstances
 some of the can be used is a different matter, the COMMA and TAIL word will
 require some explaining, but ADD, SUB and DIV will not.
 **/
-		case LOAD:    f = m[ck(f)];                   break;
-		case STORE:   m[ck(f)] = *S--; f = *S--;      break;
-		case CLOAD:   f = *(((uint8_t*)m) + ckchar(f)); break;
-		case CSTORE:  ((uint8_t*)m)[ckchar(f)] = *S--; f = *S--; break;
+		case LOAD:
+			f = f == RSTK ? R : f == DIC ? h : m[ck(f)];
+			break;
+		case STORE:
+			if (is_register(f)) {
+				sync_registers();
+				m[f] = *S--;
+				load_registers();
+			} else {
+				m[ck(f)] = *S--; 
+			}
+			f = *S--;
+			break;
+		case CLOAD:
+			if (is_register(f / sizeof(forth_cell_t)))
+				sync_registers();
+			f = *(((uint8_t*)m) + ckchar(f)); 
+			break;
+		case CSTORE:
+			if (is_register(f / sizeof(forth_cell_t))) {
+				sync_registers();
+				((uint8_t*)m)[f] = *S--;
+				load_registers();
+			} else {
+				((uint8_t*)m)[ckchar(f)] = *S--; 
+			}
+			f = *S--; 
+			break;
 		case SUB:     f = *S-- - f;                   break;
 		case ADD:     f = *S-- + f;                   break;
 		case AND:     f = *S-- & f;                   break;
@@ -2414,20 +5255,21 @@ require some explaining, but ADD, SUB and DIV will not.
 				f = *S-- / f;
 			} else {
 				error("divide %"PRIdCell" by zero ", *S--);
+				sync_registers();
 				longjmp(on_error, RECOVERABLE);
 			} 
 			break;
 		case ULESS:   f = *S-- < f;                     break;
 		case UMORE:   f = *S-- > f;                     break;
-		case EXIT:    I = m[ck(m[RSTK]--)];             break;
+		case EXIT:    I = m[ck(R--)];                   break;
 		case KEY:     *++S = f; f = forth_get_char(o);  break;
 		case EMIT:    f = fputc(f, (FILE*)o->m[FOUT]);  break;
-		case FROMR:   *++S = f; f = m[ck(m[RSTK]--)];   break;
-		case TOR:     m[ck(++m[RSTK])] = f; f = *S--;   break;
+		case FROMR:   *++S = f; f = m[ck(R--)];         break;
+		case TOR:     m[ck(++R)] = f; f = *S--;         break;
 		case BRANCH:  I += m[ck(I)];                    break;
 		case QBRANCH: I += f == 0 ? m[I] : 1; f = *S--; break;
 		case PNUM:    f = print_cell(o, (FILE*)(o->m[FOUT]), f); break;
-		case COMMA:   m[dic(m[DIC]++)] = f; f = *S--;   break;
+		case COMMA:   m[dic(h++)] = f; f = *S--;        break;
 		case EQUAL:   f = *S-- == f;                    break;
 		case SWAP:    w = f;  f = *S--;   *++S = w;     break;
 		case DUP:     *++S = f;                         break;
@@ -2460,7 +5302,7 @@ And the definition **gcd** can be used. There is a definition of **tail** within
 is hidden in favor of the new one.
 **/
 		case TAIL:
-			m[RSTK]--;
+			R--;
 			break;
 /** 
 FIND is a natural factor of READ, we add it to the Forth interpreter as
@@ -2511,7 +5353,14 @@ portable:
 **/
 		case CLOCK:
 			*++S = f;
+			if (o->replay) {
+				if (replay_event(o, EVENT_CLOCK, &f) < 0)
+					longjmp(on_error, FATAL);
+				break;
+			}
 			f = ((1000 * clock()) - clk) / CLOCKS_PER_SEC;
+			if (o->record)
+				record_event(o, EVENT_CLOCK, f);
 			break;
 /**
 EVALUATOR is another complex word which needs to be implemented in
@@ -2528,7 +5377,9 @@ or from a file.
 			/* save current input */
 			forth_cell_t sin    = o->m[SIN],  sidx = o->m[SIDX],
 				slen   = o->m[SLEN], fin  = o->m[FIN],
-				source = o->m[SOURCE_ID], r = m[RSTK];
+				source = o->m[SOURCE_ID], r = R,
+				id     = o->source;
+			size_t line = o->line;
 			char *s = NULL;
 			FILE *file = NULL;
 			forth_cell_t length;
@@ -2547,7 +5398,8 @@ or from a file.
 			o->S = S;
 			o->m[TOP] = f;
 			/* push a fake call to forth_eval */
-			m[RSTK]++;
+			m[RSTK] = R + 1;
+			m[DIC] = h;
 			if (file_in) {
 				forth_set_file_input(o, file);
 				w = forth_run(o);
@@ -2555,7 +5407,8 @@ or from a file.
 				w = forth_eval_block(o, s, length);
 			}
 			/* restore stack variables */
-			m[RSTK] = r;
+			m[RSTK] = R = r;
+			h = m[DIC];
 			S = o->S;
 			*++S = o->m[TOP];
 			f = w;
@@ -2565,6 +5418,8 @@ or from a file.
 			o->m[SLEN] = slen;
 			o->m[FIN]  = fin;
 			o->m[SOURCE_ID] = source;
+			o->source = id;
+			o->line   = line;
 			if (forth_is_invalid(o))
 				return -1;
 			break;
@@ -2572,7 +5427,7 @@ or from a file.
 		case PSTK:    print_stack(o, (FILE*)(o->m[STDOUT]), S, f);
 			      fputc('\n', (FILE*)(o->m[STDOUT]));
 			      break;
-		case RESTART: longjmp(on_error, f);                   break;
+		case RESTART: sync_registers(); longjmp(on_error, f); break;
 
 /**
 CALL allows arbitrary C functions to be passed in and used within
@@ -2607,7 +5462,17 @@ and executes the function.
 			o->S = S;
 			o->m[TOP] = f;
 			/* call arbitrary C function */
-			w = o->calls->functions[i].function(o);
+			sync_registers();
+			if (o->replay) {
+				if (call_replay(o, i, &w) < 0)
+					longjmp(on_error, FATAL);
+			} else {
+				forth_cell_t *before = o->S;
+				w = o->calls->functions[i].function(o);
+				if (o->record)
+					call_record(o, i, before, w);
+			}
+			load_registers();
 			/* restore stack state */
 			S = o->S;
 			f = o->m[TOP];
@@ -2625,14 +5490,21 @@ The file access methods *should* all be wrapped up so it does not matter
 if a file or a piece of memory (a string for example) is being read or
 written to. This would allow the KEY to be removed as a virtual machine
 instruction, and would be a useful abstraction. 
+
+Those instructions that take a Forth string may throw an error if the
+string is invalid, so the cached registers are written back first.
 **/
 
-		case SYSTEM:  f = system(forth_get_string(o, &on_error, &S, f)); break;
+		case SYSTEM:  
+			      sync_registers();
+			      f = system(forth_get_string(o, &on_error, &S, f)); 
+			      break;
 		case FCLOSE:  
 			      errno = 0;
 			      f = fclose((FILE*)f) ? ferrno() : 0;       
 			      break;
 		case FDELETE: 
+			      sync_registers();
 			      errno = 0;
 			      f = remove(forth_get_string(o, &on_error, &S, f)) ? ferrno() : 0; 
 			      break;
@@ -2657,6 +5529,7 @@ instruction, and would be a useful abstraction.
 			}
 		case FOPEN: 
 			{
+				sync_registers();
 				const char *fam = forth_get_fam(&on_error, f);
 				f = *S--;
 				char *file = forth_get_string(o, &on_error, &S, f);
@@ -2670,9 +5543,26 @@ instruction, and would be a useful abstraction.
 				FILE *file = (FILE*)f;
 				forth_cell_t count = *S--;
 				forth_cell_t offset = *S--;
+				sync_registers();
+				if (o->replay) {
+					if (replay_event(o, EVENT_READ, &w) < 0
+					|| w > count
+					|| get_cell(o->replay, &f) < 0
+					|| replay_block(o, ((char*)m)+offset, w) < 0)
+						longjmp(on_error, FATAL);
+					*++S = w;
+					load_registers();
+					break;
+				}
 				*++S = fread(((char*)m)+offset, 1, count, file);
+				load_registers();
 				f = ferror(file);
 				clearerr(file);
+				if (o->record) {
+					record_event(o, EVENT_READ, *S);
+					put_cell(o->record, f);
+					fwrite(((char*)m)+offset, 1, *S, o->record);
+				}
 			}
 			break;
 		case FWRITE:
@@ -2687,6 +5577,7 @@ instruction, and would be a useful abstraction.
 			break;
 		case FRENAME:  
 			{
+				sync_registers();
 				const char *f1 = forth_get_fam(&on_error, f);
 				f = *S--;
 				char *f2 = forth_get_string(o, &on_error, &S, f);
@@ -2709,7 +5600,15 @@ instruction, and would be a useful abstraction.
 			{
 				time_t raw;
 				struct tm *gmt;
-				time(&raw);
+				if (o->replay) {
+					if (replay_event(o, EVENT_DATE, &w) < 0)
+						longjmp(on_error, FATAL);
+					raw = (time_t)w;
+				} else {
+					time(&raw);
+					if (o->record)
+						record_event(o, EVENT_DATE, raw);
+				}
 				gmt = gmtime(&raw);
 				*++S = f;
 				*++S = gmt->tm_sec;
@@ -2726,7 +5625,8 @@ instruction, and would be a useful abstraction.
 /**
 The following memory functions can be used by the Forth interpreter
 for faster memory operations, but more importantly they can be used
-to interact with memory outside of the Forth core.
+to interact with memory outside of the Forth core, which includes the
+register area, so the cached registers must be synchronized.
 
 @todo Subtract/Add base pointer (o->m) to all memory operations that 
 occur on real memory so this does not have to be done within the
@@ -2735,25 +5635,33 @@ to be used to be useful. Both will simplify operations.
 **/
 		case MEMMOVE:
 			w = *S--;
+			sync_registers();
 			memmove((char*)(*S--), (char*)w, f);
+			load_registers();
 			f = *S--;
 			break;
 		case MEMCHR:
 			w = *S--;
+			sync_registers();
 			f = (forth_cell_t)memchr((char*)(*S--), w, f);
 			break;
 		case MEMSET:
 			w = *S--;
+			sync_registers();
 			memset((char*)(*S--), w, f);
+			load_registers();
 			f = *S--;
 			break;
 		case MEMCMP:
 			w = *S--;
+			sync_registers();
 			f = memcmp((char*)(*S--), (char*)w, f);
 			break;
 		case ALLOCATE:
 			errno = 0;
 			*++S = (forth_cell_t)calloc(f, 1);
+			if (o->heap && *S)
+				heap_allocated(o, *S, f, I);
 			f = ferrno();
 			break;
 		case FREE:
@@ -2763,6 +5671,8 @@ problem, it will most likely either abort the program or silently
 corrupt the heap if something goes wrong, however the Forth standard
 requires that an error status is returned.
 **/
+			if (o->heap)
+				heap_freed(o, f);
 			errno = 0;
 			free((char*)f);
 			f = ferrno();
@@ -2770,13 +5680,30 @@ requires that an error status is returned.
 		case RESIZE:
 			errno = 0;
 			w = (forth_cell_t)realloc((char*)(*S--), f);
+			if (o->heap && w) {
+				heap_freed(o, S[1]);
+				heap_allocated(o, w, f, I);
+			}
 			*++S = w;
 			f = ferrno();
 			break;
 		case GETENV:
 		{
+			sync_registers();
 			char *s = getenv(forth_get_string(o, &on_error, &S, f));
+			if (o->replay) {
+				if (replay_event(o, EVENT_GETENV, &w) < 0)
+					longjmp(on_error, FATAL);
+				if (!w)
+					s = NULL;
+				else if (!(s = replay_string(o, w - 1)))
+					longjmp(on_error, FATAL);
+			}
 			f = s ? strlen(s) : 0;
+			if (o->record) {
+				record_event(o, EVENT_GETENV, s ? f + 1 : 0);
+				fwrite(s ? s : "", 1, f, o->record);
+			}
 			*++S = (forth_cell_t)s;
 			break;
 		}
@@ -2784,11 +5711,452 @@ requires that an error status is returned.
 			rval = f;
 			f = *S--;
 			goto end;
+		case FOOTPRINT:
+			sync_registers();
+			forth_footprint_report(o, (FILE*)(o->m[STDOUT]), 1);
+			break;
+/**
+The spawn instructions are described where **spawn_arguments** is, when
+they are not available they fail as if the command could not be started.
+The output of **(spawn-capture)** is logged and replayed in the same way
+as **read-file**. 
+**/
+		case SPAWNCAPTURE:
+		{
+			forth_cell_t ms = f, size = *S--, buf = *S--;
+			forth_cell_t length = *S--, cmd = *S--;
+			sync_registers();
+			if (o->replay) {
+				if (replay_event(o, EVENT_READ, &w) < 0
+				|| w > size
+				|| get_cell(o->replay, &f) < 0
+				|| replay_block(o, ((char*)m)+buf, w) < 0)
+					longjmp(on_error, FATAL);
+				*++S = w;
+				load_registers();
+				break;
+			}
+#ifdef USE_SPAWN
+			*++S = spawn_capture(((char*)m)+cmd, length, 
+					((char*)m)+buf, size, ms, &f);
+#else
+			(void)ms; (void)buf; (void)length; (void)cmd;
+			*++S = 0;
+			f = -1;
+#endif
+			load_registers();
+			if (o->record) {
+				record_event(o, EVENT_READ, *S);
+				put_cell(o->record, f);
+				fwrite(((char*)m)+buf, 1, *S, o->record);
+			}
+			break;
+		}
+		case SPAWN:
+		{
+			forth_cell_t cmd = *S--;
+			errno = 0;
+#ifdef USE_SPAWN
+			int fd = -1;
+			pid_t pid = spawn_piped(((char*)m)+cmd, f, &fd);
+			FILE *file = pid < 0 ? NULL : fdopen(fd, "rb");
+			if (pid >= 0 && !file) {
+				close(fd);
+				spawn_wait(pid);
+			}
+			*++S = (forth_cell_t)file;
+			*++S = file ? pid : 0;
+			f = file ? 0 : ferrno();
+#else
+			(void)cmd;
+			*++S = 0;
+			*++S = 0;
+			f = -1;
+#endif
+			break;
+		}
+/**
+The compression and conversion instructions are described in the sections
+on LZ compression and on hex and Base64, in memory they all take the same
+arguments and return the length of the output, or -1 if the output does not
+fit or the input is not valid.
+**/
+		case COMPRESS:
+		case DECOMPRESS:
+		case TOHEX:
+		case FROMHEX:
+		case TOBASE64:
+		case FROMBASE64:
+		{
+			static size_t (*const codecs[])(const uint8_t *, size_t, 
+					uint8_t *, size_t) = {
+				[COMPRESS - COMPRESS]   = lz_compress,
+				[DECOMPRESS - COMPRESS] = lz_decompress,
+				[TOHEX - COMPRESS]      = hex_encode,
+				[FROMHEX - COMPRESS]    = hex_decode,
+				[TOBASE64 - COMPRESS]   = base64_encode,
+				[FROMBASE64 - COMPRESS] = base64_decode,
+			};
+			forth_cell_t dst = *S--, length = *S--, src = *S--;
+			if (!core_range(o, src, length) || !core_range(o, dst, f)) {
+				f = -1;
+				break;
+			}
+			sync_registers();
+			f = codecs[w - COMPRESS]
+				((uint8_t*)m + src, length, (uint8_t*)m + dst, f);
+			load_registers();
+			break;
+		}
+		case DUMP:
+		{
+			forth_cell_t base = *S--, count = *S--, address = *S--;
+			sync_registers();
+			forth_dump_memory(o, (FILE*)(o->m[FOUT]), address, count, 
+					base, f);
+			f = *S--;
+			break;
+		}
+/**
+**split-fields** and **read-record** are described with **split_fields**
+and **read_record**, as with **read-file** the records read are logged and
+replayed, along with whether the end of the file was reached.
+**/
+		case SPLIT:
+		{
+			forth_cell_t fields = *S--, delim = *S--;
+			forth_cell_t length = *S--, str = *S--;
+			if (!core_range(o, str, length)) {
+				f = -1;
+				break;
+			}
+			if (fields >= o->core_size)
+				fields = f = 0;
+			else if (f > (o->core_size - fields) / 2)
+				f = (o->core_size - fields) / 2;
+			sync_registers();
+			f = split_fields((char*)m + str, length, delim, m + fields, f);
+			load_registers();
+			break;
+		}
+		case FRECORD:
+		{
+			FILE *file = (FILE*)f;
+			forth_cell_t count = *S--, offset = *S--;
+			bool eof = false;
+			if (!core_range(o, offset, count)) {
+				*++S = 0;
+				*++S = 0;
+				f = -1;
+				break;
+			}
+			sync_registers();
+			if (o->replay) {
+				if (replay_event(o, EVENT_READ, &w) < 0
+				|| w > count
+				|| get_cell(o->replay, &f) < 0
+				|| get_cell(o->replay, &count) < 0
+				|| replay_block(o, ((char*)m)+offset, w) < 0)
+					longjmp(on_error, FATAL);
+				*++S = w;
+				*++S = count;
+				load_registers();
+				break;
+			}
+			*++S = read_record(file, ((char*)m)+offset, count, &eof);
+			*++S = !eof;
+			load_registers();
+			f = ferror(file);
+			clearerr(file);
+			if (o->record) {
+				record_event(o, EVENT_READ, S[-1]);
+				put_cell(o->record, f);
+				put_cell(o->record, *S);
+				fwrite(((char*)m)+offset, 1, S[-1], o->record);
+			}
+			break;
+		}
+/**
+**format** and **format>buf** are described with **format_render**, they
+take a variable number of arguments so the depth of the stack has to be
+checked here once the format string has been. A format string that is not
+valid, or that refers to a string outside of the core, is an error.
+**/
+		case FORMAT:
+		case FORMATBUF:
+		{
+			struct format_sink d = { .file = NULL };
+			forth_cell_t length, fmt;
+			long cells;
+			if (w == FORMATBUF) {
+				d.size = f;
+				d.buf = (char*)m + *S--;
+				if (!core_range(o, d.buf - (char*)m, d.size))
+					d.size = 0;
+				length = *S--;
+			} else {
+				d.file = (FILE*)(o->m[FOUT]);
+				length = f;
+			}
+			fmt = *S--;
+			if (!core_range(o, fmt, length) 
+			|| (cells = format_arguments((char*)m + fmt, length)) < 0) {
+				error("invalid format string '%.*s'", 
+					core_range(o, fmt, length) ? (int)length : 0, 
+					(char*)m + fmt);
+				sync_registers();
+				longjmp(on_error, RECOVERABLE);
+			}
+			cd(cells + 1);
+			sync_registers();
+			if (format_render(o, &d, (char*)m + fmt, length, 
+						S - cells + 1) < 0) {
+				error("invalid format argument for '%.*s'", 
+						(int)length, (char*)m + fmt);
+				longjmp(on_error, RECOVERABLE);
+			}
+			load_registers();
+			S -= cells;
+			if (w == FORMATBUF)
+				f = d.length <= d.size ? d.length : (forth_cell_t)-1;
+			else
+				f = *S--;
+			break;
+		}
+/**
+The screen instructions are described with **screen_refresh**.
+**/
+		case SCREENSIZE:
+			f = screen_size(o, *S--, f);
+			break;
+		case SCREENCLEAR:
+			if (o->screen)
+				memset(o->screen->back, ' ', 
+					o->screen->cols * o->screen->rows);
+			break;
+		case SCREENPUT:
+		{
+			forth_cell_t col = *S--, length = *S--, str = *S--;
+			if (core_range(o, str, length))
+				screen_put(o->screen, (char*)m + str, length, col, f);
+			f = *S--;
+			break;
+		}
+		case SCREENREFRESH:
+			f = screen_refresh(o->screen, (FILE*)(o->m[FOUT]), *S--, f);
+			break;
+/**
+**(big)** is described with **big_operation**, the depth of the stack is
+checked here as it depends on the operation.
+**/
+		case BIG:
+		{
+			static const unsigned char depths[BIG_LAST_OPERATION] = {
+				[BIG_ADD] = 2, [BIG_SUB] = 2, [BIG_MUL] = 2, 
+				[BIG_DIVMOD] = 2, [BIG_GCD] = 2, [BIG_COMPARE] = 2, 
+				[BIG_FROM_CELL] = 1, [BIG_TO_CELL] = 1, 
+				[BIG_FROM_STRING] = 2, [BIG_TO_STRING] = 3, 
+				[BIG_PRINT] = 1, [BIG_FREE] = 1,
+			};
+			w = f;
+			cd(1 + (w < BIG_LAST_OPERATION ? depths[w] : 0));
+			f = *S--;
+			sync_registers();
+			if (big_operation(o, w, &S, &f) < 0)
+				longjmp(on_error, RECOVERABLE);
+			load_registers();
+			break;
+		}
+/**
+**(timer)** performs one of the operations in **timer_operation**, adding
+and cancelling timers, waiting for the next one and reading the clock that
+they use.
+**/
+		case TIMER:
+		{
+			static const unsigned char depths[TIMER_LAST_OPERATION] = {
+				[TIMER_AFTER] = 2, [TIMER_EVERY] = 2, 
+				[TIMER_CANCEL] = 1, [TIMER_WAIT] = 1, [TIMER_TICKS] = 0,
+			};
+			w = f;
+			cd(1 + (w < TIMER_LAST_OPERATION ? depths[w] : 0));
+			f = *S--;
+			switch (w) {
+			case TIMER_AFTER:
+			case TIMER_EVERY:
+				if (f < DICTIONARY_START || f >= o->core_size || 
+						instruction(m[f]) != RUN) {
+					error("timer callback %"PRIdCell" is not a ':' word", f);
+					sync_registers();
+					longjmp(on_error, RECOVERABLE);
+				}
+				if (!(f = timer_add(o, *S--, f, w == TIMER_EVERY))) {
+					error("could not allocate timer %"PRIdCell, w);
+					sync_registers();
+					longjmp(on_error, RECOVERABLE);
+				}
+				break;
+			case TIMER_CANCEL:
+				timer_cancel(o->timers, f);
+				f = *S--;
+				break;
+			case TIMER_WAIT:
+				timer_wait(o->timers, f);
+				f = *S--;
+				break;
+			case TIMER_TICKS:
+				*++S = f;
+				f = timer_milliseconds();
+				break;
+			default:
+				error("unknown timer operation %"PRIdCell, w);
+				sync_registers();
+				longjmp(on_error, RECOVERABLE);
+			}
+			break;
+		}
+		case FCOMPRESS:
+			f = lz_compress_file((FILE*)*S--, (FILE*)f);
+			break;
+		case FDECOMPRESS:
+			f = lz_decompress_file((FILE*)*S--, (FILE*)f);
+			break;
+		case SPAWNWAIT:
+		{
+			FILE *file = (FILE*)*S--;
+			if (file)
+				fclose(file);
+#ifdef USE_SPAWN
+			f = f ? spawn_wait(f) : (forth_cell_t)-1;
+#else
+			f = -1;
+#endif
+			break;
+		}
+#ifdef USE_STACK_CACHE
+/**
+These are the copies of the most frequently used instructions for each of
+the stack cache states, as described where **USE_STACK_CACHE** is defined.
+Instructions that do not touch the variable stack are the same in each
+state.
+**/
+		case CACHE_NONE | RUN:
+		case CACHE_ONE  | RUN:
+		case CACHE_TWO  | RUN:
+			m[ck(++R)] = I; 
+			I = pc;
+			if (o->profile)
+				o->profile[pc - 1]++;
+			safepoint();
+			break;
+		case CACHE_NONE | EXIT:
+		case CACHE_ONE  | EXIT:
+		case CACHE_TWO  | EXIT:   I = m[ck(R--)];             break;
+		case CACHE_NONE | BRANCH:
+		case CACHE_ONE  | BRANCH:
+		case CACHE_TWO  | BRANCH: I += m[ck(I)];              break;
+		case CACHE_NONE | TAIL:
+		case CACHE_ONE  | TAIL:
+		case CACHE_TWO  | TAIL:   R--;                        break;
+
+		case CACHE_NONE | PUSH:  f = m[ck(I++)]; k = CACHE_ONE;     break;
+		case CACHE_ONE  | PUSH:  n = f; f = m[ck(I++)]; k = CACHE_TWO; break;
+		case CACHE_TWO  | PUSH:  *++S = n; n = f; f = m[ck(I++)];   break;
+		case CACHE_NONE | CONST: f = m[ck(pc)]; k = CACHE_ONE;      break;
+		case CACHE_ONE  | CONST: n = f; f = m[ck(pc)]; k = CACHE_TWO; break;
+		case CACHE_TWO  | CONST: *++S = n; n = f; f = m[ck(pc)];    break;
+
+		case CACHE_ONE  | QBRANCH: 
+			I += f == 0 ? m[I] : 1; 
+			k = CACHE_NONE; 
+			break;
+		case CACHE_TWO  | QBRANCH: 
+			I += f == 0 ? m[I] : 1; 
+			f = n; 
+			k = CACHE_ONE;
+			break;
+
+		case CACHE_ONE  | LOAD:
+		case CACHE_TWO  | LOAD:
+			f = f == RSTK ? R : f == DIC ? h : m[ck(f)];
+			break;
+		case CACHE_ONE  | STORE:
+		case CACHE_TWO  | STORE:
+			w = k == CACHE_TWO ? n : *S--;
+			if (is_register(f)) {
+				sync_registers();
+				m[f] = w;
+				load_registers();
+			} else {
+				m[ck(f)] = w;
+			}
+			k = CACHE_NONE;
+			break;
+
+		case CACHE_ONE  | SUB:   f = *S-- - f;                  break;
+		case CACHE_ONE  | ADD:   f = *S-- + f;                  break;
+		case CACHE_ONE  | AND:   f = *S-- & f;                  break;
+		case CACHE_ONE  | OR:    f = *S-- | f;                  break;
+		case CACHE_ONE  | XOR:   f = *S-- ^ f;                  break;
+		case CACHE_ONE  | SHL:   f = *S-- << f;                 break;
+		case CACHE_ONE  | SHR:   f = *S-- >> f;                 break;
+		case CACHE_ONE  | MUL:   f = *S-- * f;                  break;
+		case CACHE_ONE  | ULESS: f = *S-- < f;                  break;
+		case CACHE_ONE  | UMORE: f = *S-- > f;                  break;
+		case CACHE_ONE  | EQUAL: f = *S-- == f;                 break;
+		case CACHE_TWO  | SUB:   f = n - f;  k = CACHE_ONE;     break;
+		case CACHE_TWO  | ADD:   f = n + f;  k = CACHE_ONE;     break;
+		case CACHE_TWO  | AND:   f = n & f;  k = CACHE_ONE;     break;
+		case CACHE_TWO  | OR:    f = n | f;  k = CACHE_ONE;     break;
+		case CACHE_TWO  | XOR:   f = n ^ f;  k = CACHE_ONE;     break;
+		case CACHE_TWO  | SHL:   f = n << f; k = CACHE_ONE;     break;
+		case CACHE_TWO  | SHR:   f = n >> f; k = CACHE_ONE;     break;
+		case CACHE_TWO  | MUL:   f = n * f;  k = CACHE_ONE;     break;
+		case CACHE_TWO  | ULESS: f = n < f;  k = CACHE_ONE;     break;
+		case CACHE_TWO  | UMORE: f = n > f;  k = CACHE_ONE;     break;
+		case CACHE_TWO  | EQUAL: f = n == f; k = CACHE_ONE;     break;
+		case CACHE_ONE  | INV:
+		case CACHE_TWO  | INV:   f = ~f;                        break;
+
+		case CACHE_NONE | DUP:   f = *S; k = CACHE_ONE;         break;
+		case CACHE_ONE  | DUP:   n = f; k = CACHE_TWO;          break;
+		case CACHE_TWO  | DUP:   *++S = n; n = f;               break;
+		case CACHE_NONE | DROP:  S--;                           break;
+		case CACHE_ONE  | DROP:  k = CACHE_NONE;                break;
+		case CACHE_TWO  | DROP:  f = n; k = CACHE_ONE;          break;
+		case CACHE_NONE | SWAP:  n = *S--; f = *S--; k = CACHE_TWO; break;
+		case CACHE_ONE  | SWAP:  n = f; f = *S--; k = CACHE_TWO; break;
+		case CACHE_TWO  | SWAP:  w = f; f = n; n = w;           break;
+		case CACHE_NONE | OVER:  n = *S--; f = *S; k = CACHE_TWO; break;
+		case CACHE_ONE  | OVER:  n = f; f = *S; k = CACHE_TWO;  break;
+		case CACHE_TWO  | OVER:  *++S = n; w = n; n = f; f = w; break;
+
+		case CACHE_NONE | TOR:   m[ck(++R)] = *S--;             break;
+		case CACHE_ONE  | TOR:   m[ck(++R)] = f; k = CACHE_NONE; break;
+		case CACHE_TWO  | TOR:   m[ck(++R)] = f; f = n; k = CACHE_ONE; break;
+		case CACHE_NONE | FROMR: f = m[ck(R--)]; k = CACHE_ONE; break;
+		case CACHE_ONE  | FROMR: n = f; f = m[ck(R--)]; k = CACHE_TWO; break;
+		case CACHE_TWO  | FROMR: *++S = n; n = f; f = m[ck(R--)]; break;
+
+		case CACHE_NONE | COMMA: m[dic(h++)] = *S--;            break;
+		case CACHE_ONE  | COMMA: m[dic(h++)] = f; k = CACHE_NONE; break;
+		case CACHE_TWO  | COMMA: m[dic(h++)] = f; f = n; k = CACHE_ONE; break;
+#endif
 /**
 This should never happen, and if it does it is an indication that virtual
-machine memory has been corrupted somehow.
+machine memory has been corrupted somehow. If the stack cache is in use
+then it is most likely that an instruction does not have a copy for the
+current state, in which case it gets put into the state the instruction
+expects.
 **/
 		default:
+#ifdef USE_STACK_CACHE
+			if (sw != w) {
+				cache_flush();
+				sw = w;
+				goto DISPATCH;
+			}
+#endif
 			fatal("illegal operation %" PRIdCell, w);
 			longjmp(on_error, FATAL);
 		}
@@ -2798,9 +6166,14 @@ We must save the stack pointer and the top of stack when we exit the
 interpreter so the C functions like "forth_pop" work correctly. If the
 **forth_t** object has been invalidated (because something went wrong),
 we do not have to jump to *end* as functions like **forth_pop** should not
-be called on the invalidated object any longer.
+be called on the invalidated object any longer. The cached return stack
+and dictionary pointers are also written back.
 **/
 end:	
+#ifdef USE_STACK_CACHE
+	cache_flush();
+#endif
+	sync_registers();
 	o->S = S;
 	o->m[TOP] = f;
 	return rval;
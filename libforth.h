@@ -198,6 +198,31 @@ can call Can be NULL, caller frees if allocated.
 forth_t *forth_init(size_t size, FILE *in, FILE *out, 
 		const struct forth_functions *calls); 
 
+/**
+@brief Options that control how the memory for a Forth core is obtained,
+these are hints that are only acted upon on Unix systems, where the core is
+mapped instead of allocated, elsewhere they are ignored.
+**/
+enum forth_core_options {
+	FORTH_CORE_HUGE_PAGES = 1u << 0, /**< use transparent huge pages */
+	FORTH_CORE_PREFAULT   = 1u << 1, /**< fault in all pages up front */
+};
+
+/**
+@brief Like forth_init, but with control over how the core is allocated,
+which is useful for cores many megabytes in size.
+@param size  Size of interpreter environment, must be greater or equal
+to MINIMUM_CORE_SIZE
+@param in    Read from this input file.
+@param out   Output to this file.
+@param calls Used to specify arbitrary functions that the interpreter
+can call, can be NULL
+@param options a bitwise or of enum forth_core_options, or zero
+@return  forth A fully initialized forth environment or NULL.
+**/
+forth_t *forth_init_with_options(size_t size, FILE *in, FILE *out, 
+		const struct forth_functions *calls, unsigned options);
+
 /**
 @brief   Given a FORTH object it will free any memory and perform any
 internal cleanup needed. This will not free any evaluated
@@ -325,6 +350,141 @@ values mean more verbose output.
 **/
 void forth_set_debug_level(forth_t *o, enum forth_debug_level level);
 
+/**
+@brief Turn on, or off, the counting of how many times each word
+is called. Turning it off discards the counts collected so far.
+@param o initialized forth environment.
+@param enable non zero to turn profiling on, zero to turn it off
+@return int zero on success, negative if the counts could not be
+allocated
+**/
+int forth_set_profiling(forth_t *o, int enable);
+
+/**
+@brief Print out how many times each word has been called, most
+frequently called words first, and a summary of how many pages of
+the dictionary the words that were called occupy. Profiling must
+have been turned on with **forth_set_profiling** beforehand.
+@param o initialized forth environment.
+@param out file to write the report to
+@return int zero on success, negative on failure
+**/
+int forth_profile_report(forth_t *o, FILE *out);
+
+/**
+@brief Turn on, or off, the recording of where code compiled into the
+dictionary came from. Each time the input is set, with 
+**forth_set_file_input**, **forth_eval** and the like, a new source 
+identifier is used and line counting starts from one again. The 
+locations are stored outside of the Forth core. Turning recording 
+on or off discards any locations recorded so far.
+@param o initialized forth environment.
+@param enable non zero to turn recording on, zero to turn it off
+@return int zero on success, negative if the table could not be 
+allocated
+**/
+int forth_set_source_locations(forth_t *o, int enable);
+
+/**
+@brief Look up which input source and line the cell at an address
+in the dictionary was compiled from.
+@param o initialized forth environment.
+@param address cell address into the dictionary
+@param source the source identifier is written here
+@param line the line number is written here
+@return int zero if found, negative if there is no record of it
+**/
+int forth_source_location(forth_t *o, forth_cell_t address, 
+		forth_cell_t *source, forth_cell_t *line);
+
+/**
+@brief Get the identifier of the current input source, this can be
+called after setting the input to associate a name with it.
+@param o initialized forth environment.
+@return forth_cell_t current source identifier
+**/
+forth_cell_t forth_source_id(forth_t *o);
+
+/**
+@brief Turn on or off the allocation profiler, when on every block of
+memory allocated with ALLOCATE or RESIZE and released with FREE is
+tracked and charged to the word executing at the time. Any blocks
+still allocated when the environment is freed are reported as leaks.
+@param o initialized forth environment.
+@param enable non-zero to turn profiling on, zero to turn it off and
+discard the statistics collected.
+@return int zero on success, negative if the profile could not be
+allocated
+**/
+int forth_set_allocation_profiling(forth_t *o, int enable);
+
+/**
+@brief Print the allocation count, total and live bytes for each word
+that has allocated memory, those holding on to the most first.
+@param o initialized forth environment with allocation profiling on.
+@param out file to print report to
+@return int zero on success, negative on failure
+**/
+int forth_allocation_report(forth_t *o, FILE *out);
+
+/**
+@brief struct forth_footprint describes how the memory in a Forth core
+is being used, all sizes are in cells.
+**/
+struct forth_footprint {
+	forth_cell_t core;       /**< size of the entire core */
+	forth_cell_t words;      /**< number of words defined */
+	forth_cell_t headers;    /**< cells used by word headers */
+	forth_cell_t bodies;     /**< cells used by word code and data */
+	forth_cell_t dictionary; /**< cells used by the dictionary */
+	forth_cell_t unused;     /**< free cells left for the dictionary */
+	forth_cell_t stack_size; /**< size of each of the stacks */
+	forth_cell_t variable_stack_max; /**< variable stack high water mark */
+	forth_cell_t return_stack_max;   /**< return stack high water mark */
+	forth_cell_t non_zero;   /**< cells in the core that are not zero */
+};
+
+/**
+@brief Work out how the memory in a Forth core is being used, the stack
+high water marks are estimated from the deepest non-zero cell in each.
+@param o initialized forth environment.
+@param fp structure to fill in
+@return int zero on success, negative if the core is invalid
+**/
+int forth_footprint(forth_t *o, struct forth_footprint *fp);
+
+/**
+@brief Print out how the memory in a Forth core is being used, this is
+also available from within Forth as the word "footprint".
+@param o initialized forth environment.
+@param out file to print report to
+@param words non-zero to print the size of each word as well as the
+totals
+@return int zero on success, negative on failure
+**/
+int forth_footprint_report(forth_t *o, FILE *out, int words);
+
+/**
+@brief Record everything non-deterministic the interpreter consumes to a 
+log; characters read from files, the results of "clock", "date" and
+"getenv", data read with "read-file" and the results of "call". The log
+can be fed back with **forth_set_replay** to reproduce a run.
+@param o initialized forth environment.
+@param log file to write the log to, NULL stops recording. Caller closes.
+@return int zero on success, negative if a replay is in progress
+**/
+int forth_set_record(forth_t *o, FILE *log);
+
+/**
+@brief Replay a log made with **forth_set_record**, the recorded results
+are used instead of reading input, reading the clock, and the like. If
+the run diverges from the one recorded the environment is invalidated.
+@param o initialized forth environment.
+@param log file to read the log from, NULL stops replaying. Caller closes.
+@return int zero on success, negative if recording is in progress
+**/
+int forth_set_replay(forth_t *o, FILE *log);
+
 /** 
 @brief   Execute an initialized forth environment, this will read
 from input until there is no more or an error occurs. If
@@ -376,6 +536,21 @@ cannot be loaded with "forth_load_core_file".
 **/
 int forth_dump_core(forth_t *o, FILE *dump);
 
+/**
+@brief Print out a region of the Forth core as text, a few cells to a
+line, for inspecting large cores quickly. 
+@param o      initialized forth environment
+@param out    file to print to
+@param address first cell to print
+@param count  number of cells to print, this is cut short at the end of
+the core
+@param base   base to print addresses and cells in, from 2 to 36
+@param ascii  if non-zero the cells are also printed as characters
+@return int 0 if successful, non zero otherwise
+**/
+int forth_dump_memory(forth_t *o, FILE *out, forth_cell_t address, 
+		forth_cell_t count, unsigned base, int ascii);
+
 /** 
 @brief   Save the opaque FORTH object to file, this file may be
 loaded again with forth_load_core_file. The file passed in should
@@ -410,6 +585,15 @@ in binary mode ("rb").
 **/
 forth_t *forth_load_core_file(FILE *dump);
 
+/**
+@brief Like forth_load_core_file, but with control over how the core is
+allocated.
+@param dump a file handle opened on a core file
+@param options a bitwise or of enum forth_core_options, or zero
+@return forth_t a reinitialized forth object, or NULL on failure
+**/
+forth_t *forth_load_core_file_with_options(FILE *dump, unsigned options);
+
 /**
 @brief Load a core file from memory, much like forth_load_core_file. The
 size parameter must be greater or equal to the MINIMUM_CORE_SIZE, this
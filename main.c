@@ -34,6 +34,10 @@ global variable so signal handlers can access it.
 **/
 static forth_t *global_forth_environment; 
 static int enable_signal_handling;
+static int enable_profiling;
+static int enable_allocation_profiling;
+static FILE *record_log, *replay_log;
+static unsigned core_options;
 
 typedef void (*signal_handler)(int sig); /**< functions for handling signals*/
 
@@ -195,7 +199,7 @@ static void usage(const char *name)
 {
 	fprintf(stderr, 
 		"usage: %s "
-		"[-(s|l|f) file] [-e expr] [-m size] [-LSVthvnx] [-] files\n", 
+		"[-(s|l|f|r|R) file] [-e expr] [-m size] [-LSVthvnxpaHPub] [-] files\n", 
 		name);
 }
 
@@ -213,6 +217,7 @@ static void help(void)
 "Forth: A small forth interpreter build around libforth\n\n"
 "\t-h        print out this help and exit unsuccessfully\n"
 "\t-u        run the built in unit tests, then exit\n"
+"\t-b        run the built in latency benchmarks, then exit\n"
 "\t-e string evaluate a string\n"
 "\t-s file   save state of forth interpreter to file\n"
 "\t-S        save state to 'forth.core'\n"
@@ -221,9 +226,15 @@ static void help(void)
 "\t-l file   load previously saved state from file\n"
 "\t-L        load previously saved state from 'forth.core'\n"
 "\t-m size   specify forth memory size in KiB (cannot be used with '-l')\n"
+"\t-H        back the core with huge pages, if available\n"
+"\t-P        fault in all of the core's memory at start up\n"
 "\t-t        process stdin after processing forth files\n"
 "\t-v        turn verbose mode on\n"
 "\t-x        enable signal handling\n"
+"\t-p        count calls to each word, print a report on exit\n"
+"\t-a        track memory allocated by each word, report leaks on exit\n"
+"\t-r file   record all non-deterministic input to a log file\n"
+"\t-R file   replay a log made with '-r' instead of reading input\n"
 "\t-V        print out version information and exit\n"
 "\t-         stop processing options\n\n"
 "Options must come before files to execute.\n\n"
@@ -281,7 +292,7 @@ static forth_t *forth_initial_enviroment(forth_t **o, forth_cell_t size,
 	forth_set_file_input(*o, input);
 	forth_set_file_output(*o, output);
 #else
-	*o = forth_init(size, input, output, NULL);
+	*o = forth_init_with_options(size, input, output, NULL, core_options);
 #endif
 	if (!(*o)) {
 		fatal("forth initialization failed, %s", forth_strerror());
@@ -290,6 +301,19 @@ static forth_t *forth_initial_enviroment(forth_t **o, forth_cell_t size,
 
 finished:
 	forth_set_debug_level(*o, verbose);
+	if (enable_profiling && (forth_set_profiling(*o, 1) < 0 
+			|| forth_set_source_locations(*o, 1) < 0)) {
+		fatal("could not enable profiling: %s", forth_strerror());
+		exit(EXIT_FAILURE);
+	}
+	if (enable_allocation_profiling 
+			&& forth_set_allocation_profiling(*o, 1) < 0) {
+		fatal("could not enable allocation profiling: %s", 
+				forth_strerror());
+		exit(EXIT_FAILURE);
+	}
+	forth_set_record(*o, record_log); /* "-r" and "-R" are exclusive */
+	forth_set_replay(*o, replay_log);
 	forth_set_args(*o, argc, argv);
 	global_forth_environment = *o;
 	return *o;
@@ -366,6 +390,8 @@ sacrifice portability.
 			   break;
 		case 'u':
 			   return libforth_unit_tests(0, 0, 0);
+		case 'b':
+			   return libforth_benchmarks(stdout, 0);
 		case 'e':
 			if (i >= (argc - 1))
 				goto fail;
@@ -416,7 +442,8 @@ sacrifice portability.
 		case 'L':
 			if (verbose >= FORTH_DEBUG_NOTE)
 				note("loading core file '%s'", dump_name);
-			if (!(o = forth_load_core_file(dump = forth_fopen_or_die(dump_name, "rb")))) {
+			dump = forth_fopen_or_die(dump_name, "rb");
+			if (!(o = forth_load_core_file_with_options(dump, core_options))) {
 				fatal("%s, core load failed", dump_name);
 				return -1;
 			}
@@ -433,6 +460,32 @@ sacrifice portability.
 		case 'x':
 			enable_signal_handling = 1;
 			break;
+		case 'p':
+			enable_profiling = 1;
+			break;
+		case 'a':
+			enable_allocation_profiling = 1;
+			break;
+		case 'H':
+			if (o)
+				goto fail;
+			core_options |= FORTH_CORE_HUGE_PAGES;
+			break;
+		case 'P':
+			if (o)
+				goto fail;
+			core_options |= FORTH_CORE_PREFAULT;
+			break;
+		case 'r':
+			if (record_log || replay_log || (i >= argc - 1))
+				goto fail;
+			record_log = forth_fopen_or_die(argv[++i], "wb");
+			break;
+		case 'R':
+			if (record_log || replay_log || (i >= argc - 1))
+				goto fail;
+			replay_log = forth_fopen_or_die(argv[++i], "rb");
+			break;
 		default:
 		fail:
 			fatal("invalid argument '%s'", argv[i]);
@@ -467,6 +520,10 @@ done:
 
 end:	
 	fclose_input(&in);
+	if (enable_profiling)
+		forth_profile_report(o, stderr);
+	if (enable_allocation_profiling)
+		forth_allocation_report(o, stderr);
 
 /**
 If the save option has been given we only want to save valid core files,
@@ -501,6 +558,10 @@ memory used here, but only if no other errors have occurred before hand.
 **/
 
 	forth_free(o);
+	if (record_log)
+		fclose(record_log);
+	if (replay_log)
+		fclose(replay_log);
 	return rval;
 }
 
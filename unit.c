@@ -6,6 +6,11 @@
 @email    howe.r.j.89@gmail.com 
 **/  
 
+/* clock_gettime is used for timing benchmarks on Unix systems */
+#if defined(__unix__) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200809L
+#endif
+
 /*** module to test ***/
 #include "libforth.h"
 /**********************/
@@ -201,6 +206,71 @@ static unsigned unit_test_end(test_t *t, const char *unit_name)
 
 /*** end minimal test framework ***/
 
+/*** latency benchmarks ***/
+
+/**@brief A benchmark is a statement that is executed a number of times,
+ * with the time each execution takes being recorded so the distribution
+ * of its latency can be reported on, not just the average. Times are in
+ * nanoseconds, on systems other than Unix they are only as accurate as
+ * clock() is. */
+typedef struct {
+	FILE *output;       /**< where to print the results to */
+	size_t iterations;  /**< number of times to execute each statement */
+	uint64_t *samples;  /**< time taken for each execution */
+} bench_t /**< structure used to hold benchmark information */;
+
+static uint64_t bench_clock(void)
+{
+#ifdef __unix__
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (uint64_t)t.tv_sec * 1000000000ull + t.tv_nsec;
+#else
+	return (uint64_t)clock() * (1000000000ull / CLOCKS_PER_SEC);
+#endif
+}
+
+static int sample_compare(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+	return (x > y) - (x < y);
+}
+
+/**@brief Print out one line of results, as tab separated values so they
+ * can be processed by other tools and compared across releases */
+static void bench_report(bench_t *b, const char *name)
+{
+	assert(b && name);
+	uint64_t total = 0;
+	size_t n = b->iterations;
+	for (size_t i = 0; i < n; i++)
+		total += b->samples[i];
+	qsort(b->samples, n, sizeof(b->samples[0]), sample_compare);
+	fprintf(b->output, "%s\t%zu\t%llu\t%llu\t%llu\t%llu\n", name, n, 
+			(unsigned long long)b->samples[n / 2], 
+			(unsigned long long)b->samples[(n * 99) / 100], 
+			(unsigned long long)b->samples[n - 1],
+			(unsigned long long)(total / n));
+}
+
+/**@brief Time STMT, running CLEANUP (which is not timed) after each
+ * execution, then report on the results.
+ * @param BENCH   The benchmark to execute under
+ * @param NAME    Name of the benchmark in the report
+ * @param STMT    Statement to time
+ * @param CLEANUP Statement to execute after each timed statement **/
+#define measure(BENCH, NAME, STMT, CLEANUP) do {\
+	for (size_t i_ = 0; i_ < (BENCH)->iterations; i_++) {\
+		uint64_t start_ = bench_clock();\
+		STMT;\
+		(BENCH)->samples[i_] = bench_clock() - start_;\
+		CLEANUP;\
+	}\
+	bench_report((BENCH), (NAME));\
+} while (0)
+
+/*** end latency benchmarks ***/
+
 /* forth_function_1 and forth_function_2 are 
 test functions that can be called from within the interpreter */
 static int forth_function_1(forth_t *f)
@@ -215,6 +285,70 @@ static int forth_function_2(forth_t *f)
 	return 0;
 }
 
+/* forth_function_count pushes how many times it has been called, so
+we can tell whether it was called or replayed */
+static unsigned calls_made;
+static int forth_function_count(forth_t *f)
+{
+	forth_push(f, ++calls_made);
+	return 0;
+}
+
+/**@brief Measure the latency of the operations an application embedding
+ * the interpreter is most likely to perform for each request it handles.
+ * @param output     file to write the results to
+ * @param iterations number of times to run each benchmark, zero for the
+ *                   default
+ * @return zero on success, non zero on failure */
+int libforth_benchmarks(FILE *output, size_t iterations)
+{
+	bench_t b = { .output = output, .iterations = iterations };
+	struct forth_functions *ff = NULL;
+	forth_t *f = NULL, *g = NULL;
+	char *m = NULL, *n = NULL;
+	size_t size = 0, length = 0;
+	int rval = -1;
+	assert(output);
+	if (!b.iterations)
+		b.iterations = 1000;
+	if (!(b.samples = calloc(b.iterations, sizeof(b.samples[0]))))
+		return -1;
+	if (!(ff = forth_new_function_list(1)))
+		goto end;
+	ff->functions[0].depth    = 0;
+	ff->functions[0].function = forth_function_1;
+	if (!(f = forth_init(MINIMUM_CORE_SIZE, stdin, stdout, ff)))
+		goto end;
+	if (forth_eval(f, ": sq dup * ; : call-1 0 call drop drop ;") < 0)
+		goto end;
+	if (!(m = forth_save_core_memory(f, &size)))
+		goto end;
+
+	fputs("name\titerations\tp50\tp99\tmax\tmean\n", output);
+	measure(&b, "forth_init", 
+		g = forth_init(MINIMUM_CORE_SIZE, stdin, stdout, NULL), 
+		forth_free(g));
+	measure(&b, "forth_load_core_memory", 
+		g = forth_load_core_memory(m, size), 
+		forth_free(g));
+	measure(&b, "forth_save_core_memory", 
+		n = forth_save_core_memory(f, &length), 
+		free(n));
+	measure(&b, "forth_eval", forth_eval(f, "3 sq drop"), (void)0);
+	measure(&b, "forth_find", forth_find(f, ":"), (void)0);
+	measure(&b, "forth_push/forth_pop", 
+		(forth_push(f, 1), forth_pop(f)), (void)0);
+	measure(&b, "call", forth_eval(f, "call-1"), (void)0);
+	rval = 0;
+end:
+	free(m);
+	if (f)
+		forth_free(f);
+	forth_delete_function_list(ff);
+	free(b.samples);
+	return rval;
+}
+
 int libforth_unit_tests(int keep_files, int colorize, int silent)
 {
 	tb.is_silent = silent;
@@ -470,6 +604,213 @@ int libforth_unit_tests(int keep_files, int colorize, int silent)
 		state(&tb, forth_free(f));
 		state(&tb, forth_delete_function_list(ff));
 	}
+	{ /* tests for the word profiler */
+		forth_t *f = NULL;
+		FILE *report = NULL;
+		char line[128];
+		unsigned long count = 0;
+		state(&tb, f = forth_init(MINIMUM_CORE_SIZE, stdin, stdout, NULL));
+		must(&tb, f);
+		state(&tb, report = tmpfile());
+		must(&tb, report);
+
+		/* there is nothing to report until profiling is on */
+		test(&tb, forth_profile_report(f, report) < 0);
+		test(&tb, forth_set_profiling(f, 1) == 0);
+		test(&tb, forth_eval(f, ": prof 1 drop ; : x3 prof prof prof ; x3") >= 0);
+		test(&tb, forth_profile_report(f, report) == 0);
+
+		state(&tb, rewind(report));
+		while (fgets(line, sizeof(line), report))
+			if (strstr(line, "\tprof\t"))
+				sscanf(line, "%lu", &count);
+		test(&tb, count == 3);
+
+		state(&tb, fclose(report));
+		test(&tb, forth_set_profiling(f, 0) == 0);
+		state(&tb, forth_free(f));
+	}
+	{ /* tests for the allocation profiler */
+		forth_t *f = NULL;
+		FILE *report = NULL;
+		char line[128];
+		unsigned long allocs = 0, frees = 0, bytes = 0, live = 9;
+		state(&tb, f = forth_init(MINIMUM_CORE_SIZE, stdin, stdout, NULL));
+		must(&tb, f);
+		state(&tb, report = tmpfile());
+		must(&tb, report);
+
+		test(&tb, forth_allocation_report(f, report) < 0);
+		test(&tb, forth_set_allocation_profiling(f, 1) == 0);
+		test(&tb, forth_eval(f, ": keep 16 allocate drop ;"
+			" : grow 48 resize drop ; keep grow") >= 0);
+		test(&tb, forth_eval(f, "free drop") >= 0);
+		test(&tb, forth_allocation_report(f, report) == 0);
+
+		state(&tb, rewind(report));
+		while (fgets(line, sizeof(line), report))
+			if (strstr(line, "\tgrow\n"))
+				sscanf(line, "%lu %lu %lu %lu", 
+						&allocs, &frees, &bytes, &live);
+		test(&tb, allocs == 1 && frees == 1 && bytes == 48 && live == 0);
+
+		state(&tb, fclose(report));
+		test(&tb, forth_set_allocation_profiling(f, 0) == 0);
+		state(&tb, forth_free(f));
+	}
+	{ /* tests for core allocation options */
+		forth_t *f = NULL;
+		unsigned options = FORTH_CORE_HUGE_PAGES | FORTH_CORE_PREFAULT;
+		state(&tb, f = forth_init_with_options(MINIMUM_CORE_SIZE, 
+					stdin, stdout, NULL, options));
+		must(&tb, f);
+		test(&tb, forth_eval(f, ": sq dup * ; 9 sq") >= 0);
+		test(&tb, forth_pop(f) == 81);
+		state(&tb, forth_free(f));
+		state(&tb, f = forth_init_with_options(MINIMUM_CORE_SIZE, 
+					stdin, stdout, NULL, FORTH_CORE_PREFAULT));
+		must(&tb, f);
+		test(&tb, forth_eval(f, "2 3 +") >= 0);
+		test(&tb, forth_pop(f) == 5);
+		state(&tb, forth_free(f));
+	}
+	{ /* tests for the core footprint */
+		forth_t *f = NULL;
+		struct forth_footprint fp1, fp2;
+		state(&tb, f = forth_init(MINIMUM_CORE_SIZE, stdin, stdout, NULL));
+		must(&tb, f);
+		test(&tb, forth_footprint(f, &fp1) == 0);
+		test(&tb, fp1.words > 0 && fp1.core == MINIMUM_CORE_SIZE);
+		test(&tb, fp1.headers + fp1.bodies <= fp1.dictionary);
+		test(&tb, fp1.dictionary + fp1.unused < fp1.core);
+		test(&tb, fp1.non_zero >= fp1.dictionary / 2);
+
+		test(&tb, forth_eval(f, ": fp 1 2 3 4 5 6 7 8 ; fp") >= 0);
+		test(&tb, forth_footprint(f, &fp2) == 0);
+		test(&tb, fp2.words == fp1.words + 1);
+		test(&tb, fp2.headers > fp1.headers && fp2.bodies > fp1.bodies);
+		test(&tb, fp2.unused < fp1.unused);
+		test(&tb, fp2.variable_stack_max >= 8);
+		state(&tb, forth_free(f));
+	}
+	{ /* tests for dumping memory */
+		forth_t *f = NULL;
+		FILE *dump = NULL;
+		char line[256];
+		unsigned lines = 0;
+		state(&tb, f = forth_init(MINIMUM_CORE_SIZE, stdin, stdout, NULL));
+		must(&tb, f);
+		state(&tb, dump = tmpfile());
+		must(&tb, dump);
+		test(&tb, forth_dump_memory(f, dump, 0, 10, 16, 1) == 0);
+		test(&tb, forth_dump_memory(f, dump, 0, 1, 37, 0) < 0);
+		rewind(dump);
+		while(fgets(line, sizeof line, dump))
+			lines++;
+		test(&tb, lines == 3);
+		state(&tb, fclose(dump));
+		state(&tb, forth_free(f));
+	}
+	{ /* tests for the screen buffer */
+		forth_t *f = NULL;
+		FILE *out = NULL;
+		char screen[256] = { 0 };
+		size_t length = 0;
+		state(&tb, out = tmpfile());
+		must(&tb, out);
+		state(&tb, f = forth_init(MINIMUM_CORE_SIZE, stdin, out, NULL));
+		must(&tb, f);
+		test(&tb, forth_eval(f, "10 2 screen-size") >= 0 && forth_pop(f) == 0);
+		test(&tb, forth_eval(f, "here size * 104 over c! 105 over 1 + c! 2 3 0 screen-put") >= 0);
+		test(&tb, forth_eval(f, "0 1 screen-refresh") >= 0 && forth_pop(f) == 0);
+		test(&tb, forth_eval(f, "0 1 screen-refresh") >= 0 && forth_pop(f) == 0);
+		test(&tb, forth_eval(f, "here size * 111 over c! 1 4 0 screen-put") >= 0);
+		test(&tb, forth_eval(f, "0 1 screen-refresh") >= 0 && forth_pop(f) == 0);
+		rewind(out);
+		test(&tb, (length = fread(screen, 1, sizeof(screen) - 1, out)) > 0);
+		test(&tb, strstr(screen, "\x1b[2J") == screen);
+		test(&tb, strstr(screen, "\x1b[1;4Hhi\x1b[2;1H"));
+		test(&tb, strstr(screen, "\x1b[2;1H\x1b[J\x1b[2;1H\x1b[J\x1b[1;5Ho\x1b[2;1H"));
+		test(&tb, forth_eval(f, "0 0 screen-size 0 0 screen-refresh") >= 0 && forth_pop(f));
+		state(&tb, forth_free(f));
+		state(&tb, fclose(out));
+	}
+	{ /* tests for recording and replaying */
+		forth_t *f1 = NULL, *f2 = NULL;
+		struct forth_functions *ff;
+		FILE *log = NULL, *in = NULL;
+		forth_cell_t yday1 = 0, yday2 = 0;
+		state(&tb, ff = forth_new_function_list(1));
+		must(&tb, ff);
+		state(&tb, ff->functions[0].function = forth_function_count);
+		state(&tb, log = tmpfile());
+		state(&tb, in = tmpfile());
+		must(&tb, log && in);
+		state(&tb, fputs("date 0 call 0 call", in));
+
+		/* record a run */
+		state(&tb, rewind(in));
+		must(&tb, f1 = forth_init(MINIMUM_CORE_SIZE, stdin, stdout, ff));
+		test(&tb, forth_set_record(f1, log) == 0);
+		test(&tb, forth_set_replay(f1, log) < 0);
+		state(&tb, forth_set_file_input(f1, in));
+		test(&tb, forth_run(f1) >= 0);
+		test(&tb, forth_pop(f1) == 0 && forth_pop(f1) == 2);
+		test(&tb, forth_pop(f1) == 0 && forth_pop(f1) == 1);
+		state(&tb, forth_pop(f1)); /* is daylight savings time */
+		state(&tb, yday1 = forth_pop(f1));
+
+		/* the replay does not need the input, or to call anything */
+		state(&tb, rewind(log));
+		state(&tb, fclose(in));
+		state(&tb, in = tmpfile());
+		must(&tb, in);
+		must(&tb, f2 = forth_init(MINIMUM_CORE_SIZE, stdin, stdout, ff));
+		test(&tb, forth_set_replay(f2, log) == 0);
+		state(&tb, forth_set_file_input(f2, in));
+		test(&tb, forth_run(f2) >= 0);
+		test(&tb, forth_pop(f2) == 0 && forth_pop(f2) == 2);
+		test(&tb, forth_pop(f2) == 0 && forth_pop(f2) == 1);
+		state(&tb, forth_pop(f2));
+		state(&tb, yday2 = forth_pop(f2));
+		test(&tb, yday1 == yday2);
+		test(&tb, calls_made == 2);
+		test(&tb, !forth_is_invalid(f2));
+
+		state(&tb, forth_free(f1));
+		state(&tb, forth_free(f2));
+		state(&tb, fclose(in));
+		state(&tb, fclose(log));
+		state(&tb, forth_delete_function_list(ff));
+	}
+	{ /* tests for the source location table */
+		forth_t *f = NULL;
+		forth_cell_t here = 0, source = 0, line = 0, id = 0;
+		state(&tb, f = forth_init(MINIMUM_CORE_SIZE, stdin, stdout, NULL));
+		must(&tb, f);
+		test(&tb, forth_set_source_locations(f, 1) == 0);
+
+		test(&tb, forth_eval(f, "here\n\n: loc 1 2\n+ ;") >= 0);
+		here = forth_pop(f);
+		id = forth_source_id(f);
+
+		/* the header was compiled on line three, "+" on line four */
+		test(&tb, forth_source_location(f, here, &source, &line) == 0);
+		test(&tb, source == id && line == 3);
+		test(&tb, forth_eval(f, "here") >= 0);
+		test(&tb, forth_source_location(f, forth_pop(f) - 2, &source, &line) == 0);
+		test(&tb, source == id && line == 4);
+
+		/* a new source restarts the line count */
+		test(&tb, forth_eval(f, ": loc2 ; here") >= 0);
+		test(&tb, forth_source_location(f, forth_pop(f) - 1, &source, &line) == 0);
+		test(&tb, source != id && line == 1);
+
+		/* nothing is known about code compiled after being disabled */
+		test(&tb, forth_set_source_locations(f, 0) == 0);
+		test(&tb, forth_source_location(f, here, &source, &line) < 0);
+		state(&tb, forth_free(f));
+	}
 	{ 
 		FILE *core = NULL;
 		forth_t *f1 = NULL, *f2 = NULL;
@@ -499,6 +840,16 @@ int libforth_unit_tests(int keep_files, int colorize, int silent)
 		if (!keep_files)
 			state(&tb, remove("unit.core"));
 	}
+	{ /* the benchmarks should run, but their results are not checked */
+		FILE *results = NULL;
+		char line[256] = { 0 };
+		state(&tb, results = tmpfile());
+		must(&tb, results);
+		test(&tb, libforth_benchmarks(results, 16) == 0);
+		state(&tb, rewind(results));
+		test(&tb, fgets(line, sizeof(line), results));
+		test(&tb, !strcmp(line, "name\titerations\tp50\tp99\tmax\tmean\n"));
+		state(&tb, fclose(results));
+	}
 	return !!unit_test_end(&tb, "libforth");
 }
-
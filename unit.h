@@ -1,10 +1,12 @@
 #ifndef UNIT_H
 #define UNIT_H
+#include <stdio.h>
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 int libforth_unit_tests(int keep_files, int colorize, int silent);
+int libforth_benchmarks(FILE *output, size_t iterations);
 
 #ifdef __cplusplus
 }